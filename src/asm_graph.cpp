@@ -1567,18 +1567,9 @@ unsigned asm_graph_t::calc_liveness(fn_t const& fn, rh::batman_set<locator_t> co
         for(auto const& output : node.outputs())
             bitset_or(bs_size, temp_set, output.node->vlive.in);
 
-        // Now use that to calculate a new live-in set:
-        bitset_and(bs_size, temp_set, node.vlive.out); // (vlive.out holds inverted KILL)
-        bitset_or(bs_size, temp_set, node.vlive.in);
-
-        // If 'vlive.in' is changing:
-        bool const changing = !bitset_eq(bs_size, temp_set, node.vlive.in);
-
-        // Assign 'vlive.in':
-        if(changing)
-            bitset_copy(bs_size, node.vlive.in, temp_set);
-
-        return changing;
+        // Now use that to update the live-in set, tracking if it changed:
+        // (vlive.out holds inverted KILL)
+        return bitset_or_and_changed(bs_size, node.vlive.in, temp_set, node.vlive.out);
     });
 
     // Now properly set 'out' to be the union of all successor inputs:
@@ -1,5 +1,7 @@
 #include "asm_proc.hpp"
 
+#include <cmath>
+
 #ifndef NDEBUG
 #include <iostream>
 #endif
@@ -1281,3 +1283,57 @@ void asm_proc_t::verify_legal()
             compiler_warning(get_pstring(inst), fmt("Illegal opcode % used.", inst.op));
 #endif
 }
+
+std::vector<unsigned> asm_proc_t::loop_depths() const
+{
+    struct loop_t
+    {
+        unsigned begin;
+        unsigned end = 0;
+    };
+
+    // Maps each label to the last instruction that jumps backwards to it.
+    // Only the last one matters, as 'continue' statements create
+    // additional backwards jumps to the same loop header.
+    rh::batman_map<locator_t, loop_t> loops;
+
+    for(unsigned i = 0; i < code.size(); ++i)
+    {
+        asm_inst_t const& inst = code[i];
+
+        if(inst.op == ASM_LABEL)
+            loops.insert({ inst.arg.mem_head(), { .begin = i }});
+        else if(is_branch(inst.op) || ((op_flags(inst.op) & ASMF_JUMP) && !(op_flags(inst.op) & ASMF_SWITCH)))
+            if(loop_t* loop = loops.mapped(inst.arg.mem_head()))
+                loop->end = i;
+    }
+
+    // Sum the loops using a difference array:
+    std::vector<unsigned> depths(code.size() + 1, 0);
+
+    for(auto const& pair : loops)
+    {
+        if(pair.second.end > pair.second.begin)
+        {
+            depths[pair.second.begin] += 1;
+            depths[pair.second.end + 1] -= 1;
+        }
+    }
+
+    for(unsigned i = 1; i < depths.size(); ++i)
+        depths[i] += depths[i-1];
+
+    depths.pop_back();
+    return depths;
+}
+
+std::vector<float> asm_proc_t::inst_freqs() const
+{
+    std::vector<unsigned> const depths = loop_depths();
+    std::vector<float> freqs(depths.size());
+
+    for(unsigned i = 0; i < depths.size(); ++i)
+        freqs[i] = std::pow(loop_weight, std::min(depths[i], max_loop_depth));
+
+    return freqs;
+}
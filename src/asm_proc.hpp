@@ -15,6 +15,10 @@
 #include "ssa_op.hpp"
 #include "span.hpp"
 
+// Used to estimate how often code runs:
+constexpr float loop_weight = 8.0f; // Assumed iterations per loop
+constexpr unsigned max_loop_depth = 4;
+
 // A single assembly instruction.
 struct asm_inst_t
 {
@@ -178,6 +182,14 @@ public:
     // Warn if illegal instructions are used.
     void verify_legal();
 
+    // Estimates how deeply nested in loops each instruction of 'code' is.
+    // Any branch or jump to an earlier label is assumed to close a loop.
+    std::vector<unsigned> loop_depths() const;
+
+    // Estimates how often each instruction of 'code' runs per call,
+    // as 'loop_weight' raised to its loop depth.
+    std::vector<float> inst_freqs() const;
+
     label_info_t const* lookup_label(locator_t loc) const { return labels.mapped(loc.mem_head()); }
     label_info_t* lookup_label(locator_t loc) { return labels.mapped(loc.mem_head()); }
     label_info_t& get_label(locator_t loc) { return labels[loc.mem_head()]; }
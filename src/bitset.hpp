@@ -23,44 +23,146 @@ constexpr std::size_t bitset_size(std::size_t bits_required)
     return (bits_required + sizeof_bits<UInt> - 1) / sizeof_bits<UInt>;
 }
 
+// SIMD kernels for 'bitset_uint_t', selected at compile time.
+// AVX2 is used when the build enables it, falling back to SSE4.1,
+// and then to the plain scalar loops.
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#define BITSET_SIMD
+#include <immintrin.h>
+
+namespace bitset_simd
+{
+#ifdef __AVX2__
+    using vec_t = __m256i;
+
+    [[gnu::always_inline]] inline vec_t load(bitset_uint_t const* ptr) 
+        { return _mm256_loadu_si256(reinterpret_cast<vec_t const*>(ptr)); }
+    [[gnu::always_inline]] inline void store(bitset_uint_t* ptr, vec_t v) 
+        { _mm256_storeu_si256(reinterpret_cast<vec_t*>(ptr), v); }
+    [[gnu::always_inline]] inline bool any(vec_t v) 
+        { return !_mm256_testz_si256(v, v); }
+    [[gnu::always_inline]] inline vec_t zero() 
+        { return _mm256_setzero_si256(); }
+#else
+    using vec_t = __m128i;
+
+    [[gnu::always_inline]] inline vec_t load(bitset_uint_t const* ptr) 
+        { return _mm_loadu_si128(reinterpret_cast<vec_t const*>(ptr)); }
+    [[gnu::always_inline]] inline void store(bitset_uint_t* ptr, vec_t v) 
+        { _mm_storeu_si128(reinterpret_cast<vec_t*>(ptr), v); }
+    [[gnu::always_inline]] inline bool any(vec_t v) 
+        { return !_mm_testz_si128(v, v); }
+    [[gnu::always_inline]] inline vec_t zero() 
+        { return _mm_setzero_si128(); }
+#endif
+
+    // Number of 'bitset_uint_t' per vector.
+    constexpr std::size_t width = sizeof(vec_t) / sizeof(bitset_uint_t);
+}
+#endif
+
+// Applies 'op' to every element of 'lhs' and 'rhs', storing into 'lhs'.
+// 'op' must be generic, as it gets called on both vectors and UInts.
+template<typename UInt, typename Op>
+void _bitset_binary(std::size_t size, UInt* lhs, UInt const* rhs, Op const& op)
+{
+    static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
+    std::size_t i = 0;
+#ifdef BITSET_SIMD
+    if constexpr(std::is_same_v<UInt, bitset_uint_t>)
+    {
+        using namespace bitset_simd;
+        for(; i + width <= size; i += width)
+            store(lhs + i, op(load(lhs + i), load(rhs + i)));
+    }
+#endif
+    for(; i < size; ++i)
+        lhs[i] = op(lhs[i], rhs[i]);
+}
+
 template<typename UInt>
 void bitset_and(std::size_t size, UInt* lhs, UInt const* rhs)
 {
-    static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
-    for(std::size_t i = 0; i < size; ++i)
-        lhs[i] &= rhs[i];
+    _bitset_binary(size, lhs, rhs, [](auto l, auto r) { return l & r; });
 }
 
 template<typename UInt>
 void bitset_difference(std::size_t size, UInt* lhs, UInt const* rhs)
 {
-    static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
-    for(std::size_t i = 0; i < size; ++i)
-        lhs[i] &= ~rhs[i];
+    _bitset_binary(size, lhs, rhs, [](auto l, auto r) { return l & ~r; });
 }
 
 template<typename UInt>
 void bitset_flipped_difference(std::size_t size, UInt* lhs, UInt const* rhs)
 {
-    static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
-    for(std::size_t i = 0; i < size; ++i)
-        lhs[i] = rhs[i] & ~lhs[i];
+    _bitset_binary(size, lhs, rhs, [](auto l, auto r) { return r & ~l; });
 }
 
 template<typename UInt>
 void bitset_or(std::size_t size, UInt* lhs, UInt const* rhs)
 {
-    static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
-    for(std::size_t i = 0; i < size; ++i)
-        lhs[i] |= rhs[i];
+    _bitset_binary(size, lhs, rhs, [](auto l, auto r) { return l | r; });
 }
 
 template<typename UInt>
 void bitset_xor(std::size_t size, UInt* lhs, UInt const* rhs)
+{
+    _bitset_binary(size, lhs, rhs, [](auto l, auto r) { return l ^ r; });
+}
+
+// Performs 'lhs |= op(a, b)', returning true if any new bits were set.
+// Used by the fused operations below.
+template<typename UInt, typename Op>
+bool _bitset_or_changed(std::size_t size, UInt* lhs, UInt const* a, UInt const* b, Op const& op)
 {
     static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
-    for(std::size_t i = 0; i < size; ++i)
-        lhs[i] ^= rhs[i];
+    std::size_t i = 0;
+    UInt changed = 0;
+#ifdef BITSET_SIMD
+    if constexpr(std::is_same_v<UInt, bitset_uint_t>)
+    {
+        using namespace bitset_simd;
+        vec_t vchanged = zero();
+        for(; i + width <= size; i += width)
+        {
+            vec_t const l = load(lhs + i);
+            vec_t const r = op(load(a + i), load(b + i));
+            vchanged |= r & ~l;
+            store(lhs + i, l | r);
+        }
+        if(any(vchanged))
+            changed = 1;
+    }
+#endif
+    for(; i < size; ++i)
+    {
+        UInt const r = op(a[i], b[i]);
+        changed |= r & ~lhs[i];
+        lhs[i] |= r;
+    }
+    return changed;
+}
+
+// Performs 'lhs |= rhs', returning true if any new bits were set.
+template<typename UInt>
+bool bitset_or_changed(std::size_t size, UInt* lhs, UInt const* rhs)
+{
+    return _bitset_or_changed(size, lhs, rhs, rhs, [](auto x, auto) { return x; });
+}
+
+// Performs 'lhs |= a & b', returning true if any new bits were set.
+template<typename UInt>
+bool bitset_or_and_changed(std::size_t size, UInt* lhs, UInt const* a, UInt const* b)
+{
+    return _bitset_or_changed(size, lhs, a, b, [](auto x, auto y) { return x & y; });
+}
+
+// Performs 'lhs |= a & ~b', returning true if any new bits were set.
+// (This is the usual liveness transfer function: 'in |= out & ~def')
+template<typename UInt>
+bool bitset_or_and_not_changed(std::size_t size, UInt* lhs, UInt const* a, UInt const* b)
+{
+    return _bitset_or_changed(size, lhs, a, b, [](auto x, auto y) { return x & ~y; });
 }
 
 template<typename UInt>
@@ -202,7 +304,17 @@ template<typename UInt>
 bool bitset_all_clear(std::size_t size, UInt const* bitset)
 {
     static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
-    for(std::size_t i = 0; i < size; ++i)
+    std::size_t i = 0;
+#ifdef BITSET_SIMD
+    if constexpr(std::is_same_v<UInt, bitset_uint_t>)
+    {
+        using namespace bitset_simd;
+        for(; i + width <= size; i += width)
+            if(any(load(bitset + i)))
+                return false;
+    }
+#endif
+    for(; i < size; ++i)
         if(bitset[i] != 0)
             return false;
     return true;
@@ -222,7 +334,17 @@ template<typename UInt>
 bool bitset_eq(std::size_t size, UInt const* lhs, UInt const* rhs)
 {
     static_assert(std::is_unsigned<UInt>::value, "Must be unsigned.");
-    return std::equal(lhs, lhs + size, rhs, rhs + size);
+    std::size_t i = 0;
+#ifdef BITSET_SIMD
+    if constexpr(std::is_same_v<UInt, bitset_uint_t>)
+    {
+        using namespace bitset_simd;
+        for(; i + width <= size; i += width)
+            if(any(load(lhs + i) ^ load(rhs + i)))
+                return false;
+    }
+#endif
+    return std::equal(lhs + i, lhs + size, rhs + i, rhs + size);
 }
 
 template<typename UInt>
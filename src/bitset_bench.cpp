@@ -0,0 +1,109 @@
+// Microbenchmark for the bitset kernels.
+// Build and run with 'make bench'.
+// (Use 'ARCH=AMD64_AVX2' to compare against the AVX2 kernels.)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bitset.hpp"
+
+namespace
+{
+
+// Stops the compiler from optimizing away the benchmarked work.
+template<typename T>
+void keep(T const& value) { asm volatile("" : : "g"(&value) : "memory"); }
+
+template<typename Fn>
+void bench(char const* name, std::size_t size, Fn const& fn)
+{
+    using clock = std::chrono::steady_clock;
+
+    // Aim for roughly the same amount of work per size.
+    std::size_t const reps = (1 << 24) / (size + 4);
+
+    auto const start = clock::now();
+    for(std::size_t i = 0; i < reps; ++i)
+        fn();
+    auto const end = clock::now();
+
+    double const ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::printf("%-28s %5zu words %10.2f ns/op %8.3f ns/word\n", 
+                name, size, ns / reps, ns / reps / size);
+}
+
+std::vector<bitset_uint_t> random_bitset(std::size_t size)
+{
+    std::vector<bitset_uint_t> vec(size);
+    for(bitset_uint_t& v : vec)
+        v = (bitset_uint_t(std::rand()) << 32) ^ std::rand();
+    return vec;
+}
+
+} // end anonymous namespace
+
+int main()
+{
+#if defined(__AVX2__)
+    std::puts("kernels: AVX2");
+#elif defined(__SSE4_1__)
+    std::puts("kernels: SSE4.1");
+#else
+    std::puts("kernels: scalar");
+#endif
+
+    for(std::size_t size : { 1, 4, 16, 64, 256, 1024 })
+    {
+        auto lhs = random_bitset(size);
+        auto const a = random_bitset(size);
+        auto const b = random_bitset(size);
+        std::vector<bitset_uint_t> temp(size);
+        std::vector<bitset_uint_t> const zero(size);
+
+        bench("or", size, [&]
+        {
+            bitset_or(size, lhs.data(), a.data());
+            keep(lhs);
+        });
+
+        bench("and", size, [&]
+        {
+            bitset_and(size, lhs.data(), a.data());
+            keep(lhs);
+        });
+
+        bench("all_clear", size, [&]
+        {
+            keep(bitset_all_clear(size, zero.data()));
+        });
+
+        bench("eq", size, [&]
+        {
+            keep(bitset_eq(size, a.data(), a.data()));
+        });
+
+        // The dataflow update as it was written before the fused kernels:
+        bench("or_and + eq + copy", size, [&]
+        {
+            bitset_copy(size, temp.data(), a.data());
+            bitset_and(size, temp.data(), b.data());
+            bitset_or(size, temp.data(), lhs.data());
+            bool const changed = !bitset_eq(size, temp.data(), lhs.data());
+            if(changed)
+                bitset_copy(size, lhs.data(), temp.data());
+            keep(changed);
+        });
+
+        bench("or_and_changed", size, [&]
+        {
+            keep(bitset_or_and_changed(size, lhs.data(), a.data(), b.data()));
+        });
+
+        bench("or_and_not_changed", size, [&]
+        {
+            keep(bitset_or_and_not_changed(size, lhs.data(), a.data(), b.data()));
+        });
+    }
+}
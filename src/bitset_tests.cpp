@@ -2,6 +2,7 @@
 #include "bitset.hpp"
 
 #include <cstdlib>
+#include <vector>
 #include <iostream>
 
 void test_fill(bitset_t& bs, unsigned start, unsigned size)
@@ -41,3 +42,79 @@ TEST_CASE("bitset_set_n", "[bitset]")
     test_fill(bs, 200, 0);
 }
 
+
+TEST_CASE("bitset kernels", "[bitset]")
+{
+    // Sizes chosen to cover both the vector loops and their scalar tails.
+    for(std::size_t size : { 0, 1, 2, 3, 4, 5, 7, 8, 9, 17 })
+    {
+        INFO("size = " << size);
+
+        std::vector<bitset_uint_t> a(size), b(size), c(size);
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            a[i] = (bitset_uint_t(std::rand()) << 32) ^ std::rand();
+            b[i] = (bitset_uint_t(std::rand()) << 32) ^ std::rand();
+            c[i] = (bitset_uint_t(std::rand()) << 32) ^ std::rand();
+        }
+
+        auto const expect = [&](auto const& fn)
+        {
+            std::vector<bitset_uint_t> result = a;
+            for(std::size_t i = 0; i < size; ++i)
+                result[i] = fn(a[i], b[i], c[i]);
+            return result;
+        };
+
+        std::vector<bitset_uint_t> lhs;
+
+        lhs = a;
+        bitset_and(size, lhs.data(), b.data());
+        REQUIRE(lhs == expect([](auto x, auto y, auto) { return x & y; }));
+
+        lhs = a;
+        bitset_or(size, lhs.data(), b.data());
+        REQUIRE(lhs == expect([](auto x, auto y, auto) { return x | y; }));
+
+        lhs = a;
+        bitset_xor(size, lhs.data(), b.data());
+        REQUIRE(lhs == expect([](auto x, auto y, auto) { return x ^ y; }));
+
+        lhs = a;
+        bitset_difference(size, lhs.data(), b.data());
+        REQUIRE(lhs == expect([](auto x, auto y, auto) { return x & ~y; }));
+
+        lhs = a;
+        bitset_flipped_difference(size, lhs.data(), b.data());
+        REQUIRE(lhs == expect([](auto x, auto y, auto) { return y & ~x; }));
+
+        lhs = a;
+        REQUIRE(bitset_or_changed(size, lhs.data(), b.data()) == (size > 0));
+        REQUIRE(lhs == expect([](auto x, auto y, auto) { return x | y; }));
+        REQUIRE(!bitset_or_changed(size, lhs.data(), b.data()));
+
+        lhs = a;
+        REQUIRE(bitset_or_and_changed(size, lhs.data(), b.data(), c.data()) == (size > 0));
+        REQUIRE(lhs == expect([](auto x, auto y, auto z) { return x | (y & z); }));
+        REQUIRE(!bitset_or_and_changed(size, lhs.data(), b.data(), c.data()));
+
+        lhs = a;
+        REQUIRE(bitset_or_and_not_changed(size, lhs.data(), b.data(), c.data()) == (size > 0));
+        REQUIRE(lhs == expect([](auto x, auto y, auto z) { return x | (y & ~z); }));
+        REQUIRE(!bitset_or_and_not_changed(size, lhs.data(), b.data(), c.data()));
+
+        // A change confined to the last word must still be reported.
+        if(size > 0)
+        {
+            lhs.assign(size, 0);
+            std::vector<bitset_uint_t> rhs(size, 0);
+            rhs.back() = 1ull << 63;
+            REQUIRE(bitset_or_changed(size, lhs.data(), rhs.data()));
+            REQUIRE(!bitset_all_clear(size, lhs.data()));
+            REQUIRE(!bitset_eq(size, lhs.data(), a.data()));
+            REQUIRE(bitset_eq(size, lhs.data(), rhs.data()));
+            lhs.back() = 0;
+            REQUIRE(bitset_all_clear(size, lhs.data()));
+        }
+    }
+}
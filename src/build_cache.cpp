@@ -0,0 +1,253 @@
+#include "build_cache.hpp"
+
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "fnv1a.hpp"
+#include "file.hpp"
+#include "format.hpp"
+#include "guard.hpp"
+
+namespace
+{
+    struct manifest_entry_t
+    {
+        std::uint64_t hash;
+        bool absent;
+        std::string path;
+        fs::file_time_type time; // Used by 'build_cache_await_change'.
+    };
+
+    fs::path cache_dir;
+    std::uint64_t cache_key = 0;
+    bool enabled = false;
+
+    std::mutex manifest_mutex;
+    std::vector<manifest_entry_t> manifest;
+
+    std::uint64_t hash_data(void const* data, std::size_t size)
+    {
+        return fnv1a<std::uint64_t>::hash(static_cast<char const*>(data), size);
+    }
+
+    // Identifies the compiler binary, so that rebuilding the compiler invalidates the cache.
+    std::uint64_t hash_compiler(char const* argv0)
+    {
+        std::uint64_t h = fnv1a<std::uint64_t>::hash(std::string_view(VERSION));
+        h = fnv1a<std::uint64_t>::hash(std::string_view(GIT_COMMIT), h);
+
+        std::error_code ec;
+        fs::path exe = "/proc/self/exe";
+        if(!fs::exists(exe, ec))
+            exe = argv0;
+        exe = fs::canonical(exe, ec);
+
+        if(!ec)
+        {
+            std::string const str = fmt("%:%", fs::file_size(exe, ec),
+                fs::last_write_time(exe, ec).time_since_epoch().count());
+            h = fnv1a<std::uint64_t>::hash(str, h);
+        }
+
+        return h;
+    }
+
+    fs::path entry_path(char const* ext)
+    {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(cache_key));
+        return cache_dir / (std::string(buf) + ext);
+    }
+}
+
+void build_cache_init(fs::path dir, int argc, char** argv)
+{
+    cache_dir = std::move(dir);
+    enabled = true;
+
+    std::uint64_t h = hash_compiler(argc ? argv[0] : "");
+    h = fnv1a<std::uint64_t>::hash(fs::current_path().string(), h);
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string_view const arg(argv[i], std::strlen(argv[i]) + 1);
+
+        // The output path doesn't affect the ROM, so leave it out of the key:
+        if(arg == std::string_view("-o", 3) || arg == std::string_view("--output", 9))
+        {
+            ++i;
+            continue;
+        }
+        if(arg.starts_with("--output=") || (arg.starts_with("-o") && arg.size() > 3))
+            continue;
+
+        h = fnv1a<std::uint64_t>::hash(arg, h);
+    }
+    cache_key = h;
+}
+
+bool build_cache_enabled() { return enabled; }
+
+void build_cache_record_read(fs::path const& path, void const* data, std::size_t size)
+{
+    std::uint64_t const hash = hash_data(data, size);
+    std::error_code ec;
+    fs::file_time_type const time = fs::last_write_time(path, ec);
+    std::lock_guard lock(manifest_mutex);
+    manifest.push_back({ hash, false, fs::absolute(path).string(), time });
+}
+
+void build_cache_record_absent(fs::path const& path)
+{
+    std::lock_guard lock(manifest_mutex);
+    manifest.push_back({ 0, true, fs::absolute(path).string(), {} });
+}
+
+bool build_cache_lookup(std::vector<std::uint8_t>& rom)
+{
+    if(!enabled)
+        return false;
+
+    std::ifstream in(entry_path(".manifest"));
+    if(!in)
+        return false;
+
+    // The reads below shouldn't end up in this build's manifest:
+    std::size_t const manifest_size = manifest.size();
+    auto const restore = make_scope_guard([&]
+    {
+        std::lock_guard lock(manifest_mutex);
+        manifest.resize(manifest_size);
+    });
+
+    std::string line;
+    while(std::getline(in, line))
+    {
+        // Each line is: 'R <hash> <path>' or 'A <path>'
+        if(line.size() < 2)
+            return false;
+
+        if(line[0] == 'A')
+        {
+            std::error_code ec;
+            if(fs::exists(line.substr(2), ec) || ec)
+                return false;
+        }
+        else if(line[0] == 'R')
+        {
+            std::size_t const space = line.find(' ', 2);
+            if(space == std::string::npos)
+                return false;
+
+            std::uint64_t expected;
+            std::vector<std::uint8_t> data;
+            try
+            {
+                expected = std::stoull(line.substr(2, space - 2), nullptr, 16);
+                data = read_binary_file(line.substr(space + 1));
+            }
+            catch(...)
+            {
+                return false;
+            }
+
+            if(hash_data(data.data(), data.size()) != expected)
+                return false;
+        }
+        else
+            return false;
+    }
+
+    try
+    {
+        rom = read_binary_file(entry_path(".nes").string());
+    }
+    catch(...)
+    {
+        return false;
+    }
+
+    return !rom.empty();
+}
+
+void build_cache_store(std::vector<std::uint8_t> const& rom)
+{
+    if(!enabled)
+        return;
+
+    std::error_code ec;
+    fs::create_directories(cache_dir, ec);
+    if(ec)
+        return;
+
+    // Remove the old manifest, then write the ROM, then write the new manifest.
+    // This way, a manifest only ever refers to a complete ROM.
+    fs::remove(entry_path(".manifest"), ec);
+    {
+        std::ofstream out(entry_path(".nes"), std::ios::binary);
+        if(!out)
+            return;
+        out.write(reinterpret_cast<char const*>(rom.data()), rom.size());
+        if(!out)
+            return;
+    }
+
+    std::ostringstream ss;
+    {
+        std::lock_guard lock(manifest_mutex);
+        for(manifest_entry_t const& entry : manifest)
+        {
+            if(entry.absent)
+                ss << "A " << entry.path << '\n';
+            else
+            {
+                char buf[32];
+                std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(entry.hash));
+                ss << "R " << buf << ' ' << entry.path << '\n';
+            }
+        }
+    }
+
+    fs::path const temp = entry_path(".manifest.tmp");
+    {
+        std::ofstream out(temp);
+        if(!out)
+            return;
+        out << ss.str();
+        if(!out)
+            return;
+    }
+    fs::rename(temp, entry_path(".manifest"), ec);
+}
+
+void build_cache_await_change()
+{
+    std::vector<manifest_entry_t> entries;
+    {
+        std::lock_guard lock(manifest_mutex);
+        entries = manifest;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](auto const& a, auto const& b) { return a.path < b.path; });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](auto const& a, auto const& b) { return a.path == b.path; }), entries.end());
+
+    while(true)
+    {
+        for(manifest_entry_t const& entry : entries)
+        {
+            std::error_code ec;
+            fs::file_time_type const time = fs::last_write_time(entry.path, ec);
+
+            if(entry.absent ? !ec : (ec || time != entry.time))
+                return;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef BUILD_CACHE_HPP
+#define BUILD_CACHE_HPP
+
+// An on-disk cache of compiled ROMs, keyed by the compiler, its arguments,
+// and the contents of every file the compiler reads.
+//
+// While compiling, each file read and each failed path lookup is recorded
+// into a manifest. A later build with the same key re-checks the manifest,
+// and if nothing changed, the cached ROM is used instead of compiling.
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = ::std::filesystem;
+
+// Enables the cache. 'argv' is hashed into the key.
+void build_cache_init(fs::path cache_dir, int argc, char** argv);
+
+bool build_cache_enabled();
+
+// Recording happens even when the cache isn't enabled,
+// as configuration files are read before the cache can be enabled.
+// These are thread-safe.
+void build_cache_record_read(fs::path const& path, void const* data, std::size_t size);
+void build_cache_record_absent(fs::path const& path);
+
+// Returns true and fills 'rom' if a valid entry exists.
+bool build_cache_lookup(std::vector<std::uint8_t>& rom);
+
+// Writes the manifest and ROM of the current build.
+void build_cache_store(std::vector<std::uint8_t> const& rom);
+
+// Blocks until one of the recorded files changes, appears, or disappears.
+// Used by '--watch', and works even when the cache isn't enabled.
+void build_cache_await_change();
+
+#endif
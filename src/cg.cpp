@@ -23,6 +23,7 @@
 #include "locator.hpp"
 #include "rom.hpp"
 #include "asm_graph.hpp"
+#include "trace.hpp"
 
 // TODO: make this way more efficient
 /*
@@ -139,6 +140,8 @@ private:
 
 std::size_t code_gen(log_t* log, ir_t& ir, fn_t& fn)
 {
+    trace_span_t const span("code_gen", "cg");
+
     /////////////////////////////////////
     // CFG EDGE SPLITTING AND HOISTING //
     /////////////////////////////////////
@@ -594,8 +597,11 @@ std::size_t code_gen(log_t* log, ir_t& ir, fn_t& fn)
     }
     
     ir.assert_valid(true);
-    schedule_ir(ir);
-    o_schedule(ir);
+    {
+        trace_span_t const span("schedule", "cg");
+        schedule_ir(ir);
+        o_schedule(ir);
+    }
 
     for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
     {
@@ -19,9 +19,13 @@
 
 struct cfg_liveness_d
 {
+    // Only used by the dense representation:
     bitset_uint_t* in;
     bitset_uint_t* out; // Also used to hold the 'KILL' set temporarily.
 
+    // Position in the reverse postorder used by the sparse representation:
+    unsigned rpo_index;
+
     // Memoized size of in and out:
     unsigned in_popcount;
     unsigned out_popcount;
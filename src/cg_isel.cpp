@@ -1,5 +1,6 @@
 #include "cg_isel.hpp"
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <type_traits>
@@ -20,6 +21,8 @@
 #include "globals.hpp"
 #include "group.hpp"
 #include "cg_cset.hpp"
+#include "cg_liveness.hpp"
+#include "cg_isel_map.hpp"
 #include "options.hpp"
 #include "ir_algo.hpp"
 #include "worklist.hpp"
@@ -28,6 +31,7 @@
 #include "switch.hpp"
 #include "asm_graph.hpp"
 #include "rom.hpp"
+#include "trace.hpp"
 
 #pragma GCC diagnostic ignored "-Waddress"
 
@@ -44,17 +48,23 @@ namespace isel
         // Is reset at the start of the algorithm.
         array_pool_t<sel_t, 4098> sel_pool;
 
-        using map_t = rh::batman_map<cpu_t, sel_pair_t>;
+        using map_t = state_map_t<cpu_t, sel_pair_t>;
 
         // These track the in-flight selections:
         map_t map;
         map_t next_map;
         unsigned max_map_size = 0;
+        bool map_saturated = false; // Set when a step exceeds 'max_map_size'.
 
         // The current best selection has this cost:
         isel_cost_t best_cost = ~0;
         isel_cost_t next_best_cost = ~0;
 
+        // Counted for '--isel-stats':
+        std::uint64_t cutoff_prunes = 0;
+        std::uint64_t beam_prunes = 0;
+        unsigned peak_map_size = 0;
+
         // Tracks what we're currently compiling:
         fn_ht fn = {};
         cfg_ht cfg_node = {};
@@ -281,7 +291,10 @@ namespace isel
         isel_cost_t const sel_cost = sp.cost;
 
         if(sel_cost > state.next_best_cost + cost_cutoff(state.next_map.size()))
+        {
+            ++state.cutoff_prunes;
             return;
+        }
 
         state_t::map_t::value_type insertion = { cpu, sp };
 
@@ -327,6 +340,8 @@ namespace isel
         // Run every selection step:
         if(state.map.size() > state.max_map_size)
         {
+            state.map_saturated = true;
+            state.beam_prunes += state.map.size() - state.max_map_size;
             state.indices.resize(state.map.size());
 
             auto const begin = state.indices.begin();
@@ -348,15 +363,22 @@ namespace isel
                 std::pop_heap(begin, end, comp);
                 auto const& pair = state.map.begin()[*(--end)];
                 if(pair.second.cost > cutoff)
+                {
+                    state.cutoff_prunes += state.max_map_size - i;
                     break;
+                }
                 fn(pair.first, pair.second, &cont);
             }
         }
         else
         {
             for(auto const& pair : state.map)
+            {
                 if(pair.second.cost <= cutoff)
                     fn(pair.first, pair.second, &cont);
+                else
+                    ++state.cutoff_prunes;
+            }
         }
 
         if(state.next_map.empty())
@@ -371,6 +393,7 @@ namespace isel
                                                         state.ssa_node->op());
         }
 
+        state.peak_map_size = std::max<unsigned>(state.peak_map_size, state.next_map.size());
         state.map.swap(state.next_map);
 
         state.best_cost = state.next_best_cost;
@@ -5128,17 +5151,17 @@ namespace isel
             if(loc.lclass() == LOC_SSA || loc.lclass() == LOC_PHI)
             {
                 ssa_ht const h = loc.ssa_node();
-                if(h->cfg_node() == cfg || bitset_test(d.live.in, h.id))
+                if(h->cfg_node() == cfg || live_in(cfg, h))
                     return loc;
 
                 // Check parent
                 ssa_value_t const o = orig_def(h);
-                if(o.holds_ref() && o.handle() != h && cset_head(h) == cset_head(o.handle()) && bitset_test(d.live.in, o.handle().id))
+                if(o.holds_ref() && o.handle() != h && cset_head(h) == cset_head(o.handle()) && live_in(cfg, o.handle()))
                     return locator_t::ssa(o.handle());
 
                 // Check children
                 for(ssa_ht cset = cset_head(h); cset; cset = cset_next(cset))
-                    if(cset != h && orig_def(cset) == h && bitset_test(d.live.in, cset.id))
+                    if(cset != h && orig_def(cset) == h && live_in(cfg, cset))
                         return locator_t::ssa(cset);
 
                 return LOC_NONE;
@@ -5221,6 +5244,9 @@ namespace isel
 std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
 {
     using namespace isel;
+    trace_span_t const span("isel", "cg");
+    auto const start_time = std::chrono::steady_clock::now();
+    bool const track_stats = compiler_options().isel_stats;
 
     state.log = log;
     state.fn = fn.handle();
@@ -5274,18 +5300,39 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
     static TLS std::vector<rh::apair<cross_cpu_t, isel_cost_t>> new_out_states;
 
     bool const sloppy = fn.sloppy();
-    unsigned const BASE_SEL_SIZE = sloppy ? 2 : 32;
-    unsigned const BASE_MAP_SIZE = sloppy ? 4 : 128;
+    unsigned const beam = compiler_options().isel_beam;
+    unsigned const SLOPPY_SEL_SIZE = 2;
+    unsigned const SLOPPY_MAP_SIZE = 4;
+    unsigned const FULL_SEL_SIZE = beam ? std::max(beam / 4, 1u) : sloppy ? SLOPPY_SEL_SIZE : 32;
+    unsigned const FULL_MAP_SIZE = beam ? beam : sloppy ? SLOPPY_MAP_SIZE : 128;
     auto const SELS_COST_BOUND = sloppy ? cost_fn(NOP_IMPLIED) / 2 : cost_fn(LDA_ABSOLUTE) * 2;
+    unsigned const PBQP_REFINE_PASSES = 4;
+    bool const adaptive = compiler_options().isel_adaptive && !sloppy;
+    unsigned const ADAPTIVE_SHIFT = 4; // Start at 1/16th the width.
+    unsigned base_sel_size = FULL_SEL_SIZE;
+    unsigned base_map_size = FULL_MAP_SIZE;
+
+    // Narrows the search once less than half of the optimization budget remains,
+    // reaching the sloppy sizes when it runs out:
+    auto const fit_budget = [&]
+    {
+        float const scale = fn.opt_budget_left() * 2.0f;
+        if(scale >= 1.0f)
+            return;
+        base_sel_size = std::min(FULL_SEL_SIZE, std::max<unsigned>(SLOPPY_SEL_SIZE, FULL_SEL_SIZE * scale));
+        base_map_size = std::min(FULL_MAP_SIZE, std::max<unsigned>(SLOPPY_MAP_SIZE, FULL_MAP_SIZE * scale));
+    };
 
     auto const shrink_sels = [&](cfg_ht cfg)
     {
         auto& d = data(cfg);
 
-        unsigned max_sels = std::min<unsigned>(1 + loop_depth(cfg), 4) * BASE_SEL_SIZE;
+        unsigned max_sels = std::min<unsigned>(1 + loop_depth(cfg), 4) * base_sel_size;
 
         if(d.sels.size() > max_sels)
         {
+            d.stats.truncated = d.sels.size() - max_sels;
+
             // Reuse 'rebuilt':
             rebuilt.clear();
             rebuilt.reserve(max_sels);
@@ -5313,9 +5360,12 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
         }
     };
 
-    // Create the initial worklist:
+    // Create the initial worklist.
+    // It pops from the back, so pushing in postorder visits in reverse postorder.
+    // This way, most nodes get visited after their predecessors have provided
+    // their output states, rather than being searched again for each one.
     assert(cfg_worklist.empty());
-    for(cfg_ht cfg : postorder | std::views::reverse)
+    for(cfg_ht cfg : postorder)
     {
         assert(!cfg->test_flags(FLAG_IN_WORKLIST));
         cfg_worklist.push(cfg);
@@ -5340,8 +5390,31 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
             continue;
 
         state.cfg_node = cfg;
-        setup_rolling_window(cfg);
+
+        std::chrono::steady_clock::time_point visit_start;
+        if(track_stats)
+        {
+            visit_start = std::chrono::steady_clock::now();
+            state.cutoff_prunes = 0;
+            state.beam_prunes = 0;
+            state.peak_map_size = 0;
+        }
+
+        // The rolling window only depends on the schedule,
+        // so it's computed once rather than on every revisit:
+        if(!d.rolling_window_ready)
+        {
+            setup_rolling_window(cfg);
+            d.rolling_window_ready = true;
+        }
+
+        fit_budget();
         unsigned repairs = 0;
+
+        // In adaptive mode, the search starts narrow and is widened
+        // for as long as doing so finds a better selection:
+        unsigned beam_shift = adaptive ? ADAPTIVE_SHIFT : 0;
+        isel_cost_t prev_best_cost = ~0;
     do_selections:
         dprint(state.log, "-ISEL_CFG", cfg);
 
@@ -5362,16 +5435,19 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
                     asm_inst_t{ .op = ASM_PRUNED, .arg = locator_t::index(index) }) });
         }
 
-        state.max_map_size = std::min<unsigned>(1 + loop_depth(cfg), 4) * BASE_MAP_SIZE;
+        state.max_map_size = std::min<unsigned>(1 + loop_depth(cfg), 4) * base_map_size;
 
         // Shrink the map size for large CFG nodes:
         if(cfg->ssa_size() > 64)
         {
             state.max_map_size *= 64;
             state.max_map_size /= cfg->ssa_size();
-            state.max_map_size = std::max<unsigned>(BASE_MAP_SIZE / 2, state.max_map_size);
+            state.max_map_size = std::max<unsigned>(base_map_size / 2, state.max_map_size);
         }
 
+        state.max_map_size = std::max<unsigned>(state.max_map_size >> beam_shift, 1);
+        state.map_saturated = false;
+
         // Modes get stack instructions:
         if(cfg == ir.root && state.fn->fclass == FN_MODE)
         {
@@ -5478,6 +5554,14 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
             catch(...) { throw; }
         }
 
+        // A wider search can only help if the map was pruned:
+        if(beam_shift > 0 && state.map_saturated && state.best_cost < prev_best_cost)
+        {
+            prev_best_cost = state.best_cost;
+            --beam_shift;
+            goto do_selections;
+        }
+
         // Clear after computing:
         d.to_compute.clear();
 
@@ -5694,6 +5778,16 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
                 }
             }
         }
+
+        if(track_stats)
+        {
+            d.stats.visits += 1;
+            d.stats.max_beam = std::max(d.stats.max_beam, state.max_map_size);
+            d.stats.peak_map = std::max(d.stats.peak_map, state.peak_map_size);
+            d.stats.cutoff_prunes += state.cutoff_prunes;
+            d.stats.beam_prunes += state.beam_prunes;
+            d.stats.time += std::chrono::steady_clock::now() - visit_start;
+        }
     }
 
     for(cfg_ht cfg = ir.cfg_begin(); cfg; ++cfg)
@@ -5759,9 +5853,27 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
         assert(data(cfg).is_reset());
 #endif
 
+    auto const pbqp_start_time = std::chrono::steady_clock::now();
     {
+        trace_span_t const pbqp_span("pbqp", "cg");
         pbqp_t pbqp(state.log);
 
+        static TLS rh::batman_set<cross_cpu_t> distinct_out;
+        static TLS rh::batman_set<cross_cpu_t> distinct_in;
+        static TLS std::vector<unsigned> out_indices;
+        static TLS std::vector<unsigned> in_indices;
+        static TLS std::vector<pbqp_cost_t> pair_costs;
+
+        // Maps each selection to the index of its state in 'distinct':
+        auto const distinct_states = [](auto const& sels, rh::batman_set<cross_cpu_t>& distinct, 
+                                        std::vector<unsigned>& indices, auto const& get_state)
+        {
+            distinct.clear();
+            indices.resize(sels.size());
+            for(unsigned i = 0; i < sels.size(); ++i)
+                indices[i] = distinct.insert(get_state(sels.begin()[i].first)).first - distinct.begin();
+        };
+
         for(cfg_ht cfg = ir.cfg_begin(); cfg; ++cfg)
         {
             auto& d = data(cfg);
@@ -5787,13 +5899,17 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
 
                 isel_cost_t const multiplier = depth_exp(edge_depth(cfg, oe.handle));
 
-                std::vector<pbqp_cost_t> cost_matrix(d.sels.size() * od.sels.size());
-                for(unsigned y = 0; y < od.sels.size(); ++y)
-                for(unsigned x = 0; x < d.sels.size(); ++x)
+                // Many selections share the same states,
+                // so the cost is calculated once per distinct pair of states:
+                distinct_states(d.sels, distinct_out, out_indices, [](auto const& t) { return t.out_state; });
+                distinct_states(od.sels, distinct_in, in_indices, [](auto const& t) { return t.in_state; });
+
+                pair_costs.resize(distinct_out.size() * distinct_in.size());
+                for(unsigned y = 0; y < distinct_in.size(); ++y)
+                for(unsigned x = 0; x < distinct_out.size(); ++x)
                 {
-                    cross_cpu_t const& in  = od.sels.begin()[y].first.in_state;
-                    cross_cpu_t const& out = d.sels.begin()[x].first.out_state;
-                    cross_cpu_t const loads = cross_loads(in, out, oe.handle, oe.index);
+                    cross_cpu_t const loads = cross_loads(distinct_in.begin()[y], distinct_out.begin()[x], 
+                                                          oe.handle, oe.index);
 
                     pbqp_cost_t cost = 0;
 
@@ -5811,17 +5927,45 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
                         cost += add_to_cost * 3;
                     }
 
-                    cost_matrix[x + y * d.sels.size()] = cost * multiplier;
+                    pair_costs[x + y * distinct_out.size()] = cost * multiplier;
                 }
 
-                pbqp.add_edge(d, od, std::move(cost_matrix));
+                pbqp_cost_t* const cost_matrix = pbqp.new_matrix(d.sels.size() * od.sels.size());
+                for(unsigned y = 0; y < od.sels.size(); ++y)
+                for(unsigned x = 0; x < d.sels.size(); ++x)
+                    cost_matrix[x + y * d.sels.size()] = pair_costs[out_indices[x] + in_indices[y] * distinct_out.size()];
+
+                pbqp.add_edge(d, od, cost_matrix);
             }
         }
 
         std::vector<pbqp_node_t*> pbqp_order;
         for(cfg_ht cfg : postorder)
             pbqp_order.push_back(&data(cfg));
-        pbqp.solve(std::move(pbqp_order));
+        pbqp.solve(std::move(pbqp_order), sloppy ? 0 : PBQP_REFINE_PASSES);
+    }
+
+    if(track_stats)
+    {
+        auto const now = std::chrono::steady_clock::now();
+        fn_isel_stats_t stats = 
+        { 
+            .name = fn.global.name,
+            .time = now - start_time,
+            .pbqp_time = now - pbqp_start_time,
+        };
+
+        for(cfg_ht cfg = ir.cfg_begin(); cfg; ++cfg)
+        {
+            auto& d = data(cfg);
+            d.stats.cfg_id = cfg.id;
+            d.stats.ssa_size = cfg->ssa_size();
+            d.stats.sels = d.sels.size();
+            d.stats.final_cost = d.final_cost();
+            stats.cfgs.push_back(d.stats);
+        }
+
+        submit_isel_stats(std::move(stats));
     }
 
     ///////////////////////////
@@ -6062,6 +6206,7 @@ std::size_t select_instructions(log_t* log, fn_t& fn, ir_t& ir)
     // GRAPH OPTIMIZATION //
     ////////////////////////
 
+    trace_span_t const graph_span("asm_graph", "cg");
     asm_graph_t graph(log, locator_t::cfg_label(ir.root));
 
     if(std::ostream* os = fn.info_stream())
@@ -14,6 +14,7 @@
 #include "ir.hpp"
 #include "pbqp.hpp"
 #include "cg_isel_cpu.hpp"
+#include "isel_stats.hpp"
 #include "thread.hpp"
 
 struct isel_no_progress_error_t : public std::exception
@@ -73,6 +74,7 @@ namespace isel
     struct cfg_d : public pbqp_node_t
     {
         unsigned iter = 0;
+        bool rolling_window_ready = false; // Set after 'setup_rolling_window' runs.
 
         std::vector<prep_flags_t> prep;
         std::vector<unsigned> to_compute;
@@ -82,6 +84,8 @@ namespace isel
 
         std::vector<rh::robin_map<locator_t, memoized_input_t>> memoized_input_maps;
 
+        cfg_isel_stats_t stats; // Only tracked for '--isel-stats'.
+
         std::vector<asm_inst_t> const& final_code() const { return *sels.begin()[sel].second.code; }
         std::vector<asm_inst_t>& final_code() { return *sels.begin()[sel].second.code; }
 
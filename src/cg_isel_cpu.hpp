@@ -3,6 +3,7 @@
 
 #include <array>
 #include <cstdint>
+#include <cstring>
 #ifndef NDEBUG
 #include <iostream>
 #endif
@@ -135,9 +136,12 @@ struct cpu_t
         std::size_t h = req_store;
         for(locator_t const& v : defs)
             h = rh::hash_combine(h, v.to_uint());
-        for(unsigned i = 0; i < known.size(); ++i)
-            h = rh::hash_combine(h, known[i]);
-        h = rh::hash_combine(h, known_mask);
+        // 'known' is zero when unknown, so it can be hashed as one word:
+        static_assert(sizeof(known) < sizeof(std::uint64_t));
+        std::uint64_t known_word = 0;
+        std::memcpy(&known_word, known.data(), sizeof(known));
+        known_word |= std::uint64_t(known_mask) << 56;
+        h = rh::hash_combine(h, known_word);
         return h;
     }
     
@@ -0,0 +1,167 @@
+#ifndef CG_ISEL_MAP_HPP
+#define CG_ISEL_MAP_HPP
+
+// A hash map specialized for the in-flight selections of 'cg_isel.cpp',
+// which are keyed by 'cpu_t' and rebuilt at every selection step.
+//
+// - Iteration follows insertion order, like 'rh::batman_map'.
+// - Hashes are stored, so keys are only compared on a full hash match,
+//   and growing the table never rehashes a key.
+// - Buckets are probed in groups of 4, using SSE2 when available.
+// - Clearing only touches the buckets in use, not the whole table.
+//
+// Values are never erased, so there's no need for tombstones.
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "robin/apair.hpp"
+#include "robin/hash.hpp"
+#include "builtin.hpp"
+
+namespace isel
+{
+
+template<typename Key, typename Mapped, typename Hash = std::hash<Key>>
+class state_map_t
+{
+public:
+    using key_type = Key;
+    using mapped_type = Mapped;
+    using value_type = rh::apair<Key, Mapped>;
+    using iterator = value_type*;
+    using const_iterator = value_type const*;
+
+    static constexpr unsigned GROUP_SIZE = 4;
+
+    iterator begin() { return m_values.data(); }
+    iterator end() { return m_values.data() + m_values.size(); }
+    const_iterator begin() const { return m_values.data(); }
+    const_iterator end() const { return m_values.data() + m_values.size(); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    std::size_t size() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
+
+    // Returns the value of 'v.first', and true if 'v' was inserted.
+    rh::apair<iterator, bool> insert(value_type const& v)
+    {
+        std::uint32_t const hash = hash_of(v.first);
+
+        if(m_values.size() >= m_rehash_size)
+            grow();
+
+        for(std::uint32_t group = hash & m_group_mask;; group = (group + 1) & m_group_mask)
+        {
+            std::uint32_t const* hashes = m_hashes.data() + group * GROUP_SIZE;
+
+            for(unsigned matches = match(hashes, hash); matches; matches &= matches - 1)
+            {
+                std::uint32_t const index = m_indices[group * GROUP_SIZE + builtin::ctz(matches)];
+                if(m_values[index].first == v.first)
+                    return { begin() + index, false };
+            }
+
+            if(unsigned const free = match(hashes, 0))
+            {
+                std::uint32_t const slot = group * GROUP_SIZE + builtin::ctz(free);
+                m_hashes[slot] = hash;
+                m_indices[slot] = m_values.size();
+                m_slots.push_back(slot);
+                m_values.push_back(v);
+                return { end() - 1, true };
+            }
+        }
+    }
+
+    void clear()
+    {
+        for(std::uint32_t slot : m_slots)
+            m_hashes[slot] = 0;
+        m_slots.clear();
+        m_values.clear();
+    }
+
+    void swap(state_map_t& o)
+    {
+        m_hashes.swap(o.m_hashes);
+        m_indices.swap(o.m_indices);
+        m_slots.swap(o.m_slots);
+        m_values.swap(o.m_values);
+        std::swap(m_group_mask, o.m_group_mask);
+        std::swap(m_rehash_size, o.m_rehash_size);
+    }
+
+private:
+    static std::uint32_t hash_of(Key const& key)
+    {
+        std::size_t const h = rh::hash_finalize(Hash{}(key));
+        std::uint32_t const h32 = h ^ (h >> 32);
+        return h32 ? h32 : 1; // Zero marks a free bucket.
+    }
+
+    // Returns a bitset of which buckets in the group hold 'hash'.
+    static unsigned match(std::uint32_t const* hashes, std::uint32_t hash)
+    {
+#ifdef __SSE2__
+        static_assert(GROUP_SIZE == 4);
+        __m128i const group = _mm_loadu_si128(reinterpret_cast<__m128i const*>(hashes));
+        __m128i const eq = _mm_cmpeq_epi32(group, _mm_set1_epi32(hash));
+        return _mm_movemask_ps(_mm_castsi128_ps(eq));
+#else
+        unsigned ret = 0;
+        for(unsigned i = 0; i < GROUP_SIZE; ++i)
+            ret |= unsigned(hashes[i] == hash) << i;
+        return ret;
+#endif
+    }
+
+    void grow()
+    {
+        std::uint32_t const num_groups = m_hashes.empty() ? 8 : (m_group_mask + 1) * 2;
+        m_group_mask = num_groups - 1;
+        // Keep the load factor under 3/4:
+        m_rehash_size = num_groups * GROUP_SIZE * 3 / 4;
+
+        std::vector<std::uint32_t> old_hashes(num_groups * GROUP_SIZE);
+        old_hashes.swap(m_hashes);
+        m_indices.resize(num_groups * GROUP_SIZE);
+
+        // Re-insert using the stored hashes.
+        // Every key is unique, so there's no need to compare them.
+        for(std::uint32_t& slot : m_slots)
+        {
+            std::uint32_t const hash = old_hashes[slot];
+            std::uint32_t const index = &slot - m_slots.data();
+
+            for(std::uint32_t group = hash & m_group_mask;; group = (group + 1) & m_group_mask)
+            {
+                if(unsigned const free = match(m_hashes.data() + group * GROUP_SIZE, 0))
+                {
+                    slot = group * GROUP_SIZE + builtin::ctz(free);
+                    m_hashes[slot] = hash;
+                    m_indices[slot] = index;
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> m_hashes;  // Per bucket, or 0 if free.
+    std::vector<std::uint32_t> m_indices; // Per bucket, indexing 'm_values'.
+    std::vector<std::uint32_t> m_slots;   // Per value, the bucket it's in.
+    std::vector<value_type> m_values;     // In insertion order.
+    std::uint32_t m_group_mask = 0;
+    std::uint32_t m_rehash_size = 0;
+};
+
+} // end namespace isel
+
+#endif
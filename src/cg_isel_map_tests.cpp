@@ -0,0 +1,49 @@
+#include "catch/catch.hpp"
+#include "cg_isel_map.hpp"
+
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+TEST_CASE("state_map", "[isel]")
+{
+    isel::state_map_t<unsigned, int> map;
+    isel::state_map_t<unsigned, int> other;
+
+    for(int round = 0; round < 4; ++round)
+    {
+        std::map<unsigned, int> stdmap;
+        std::vector<unsigned> order;
+
+        map.clear();
+        REQUIRE(map.empty());
+        REQUIRE(map.begin() == map.end());
+
+        for(int i = 0; i < 2000; ++i)
+        {
+            unsigned const x = std::rand() % (256 << round);
+            auto stdpair = stdmap.insert({ x, i });
+            auto pair = map.insert({ x, i });
+
+            REQUIRE(stdpair.second == pair.second);
+            REQUIRE(pair.first->first == x);
+            REQUIRE(pair.first->second == stdpair.first->second);
+            REQUIRE(stdmap.size() == map.size());
+
+            if(stdpair.second)
+                order.push_back(x);
+        }
+
+        // Iteration follows insertion order:
+        REQUIRE((std::size_t)(map.end() - map.begin()) == order.size());
+        for(std::size_t i = 0; i < order.size(); ++i)
+            REQUIRE(map.begin()[i].first == order[i]);
+
+        // Swapping back and forth clears and reuses both tables:
+        map.swap(other);
+        REQUIRE(other.size() == order.size());
+
+        for(unsigned x : order)
+            REQUIRE(other.insert({ x, -1 }).second == false);
+    }
+}
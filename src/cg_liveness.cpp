@@ -13,15 +13,250 @@ namespace liveness_impl
     TLS array_pool_t<bitset_uint_t> bitset_pool;
     TLS unsigned set_size;
     TLS unsigned reserved_size;
+    TLS bool sparse;
+}
+
+// Functions whose dense live sets would need more words than this
+// use the sparse representation instead.
+static constexpr std::size_t SPARSE_THRESHOLD = 1 << 16;
+
+///////////////////////////
+// sparse representation //
+///////////////////////////
+
+// The sparse representation stores, for each SSA node, the CFG nodes
+// it is live at as sorted intervals over a reverse postorder.
+// Live ranges tend to be contiguous in this order, keeping the intervals few.
+
+namespace
+{
+
+// A half-open range of 'rpo_index'.
+struct live_interval_t
+{
+    unsigned begin;
+    unsigned end;
+};
+
+struct ssa_liveness_d
+{
+    live_interval_t const* in = nullptr;
+    live_interval_t const* out = nullptr;
+    unsigned in_size = 0;
+    unsigned out_size = 0;
+};
+
+} // end anonymous namespace
+
+static TLS array_pool_t<live_interval_t> interval_pool;
+static TLS std::vector<ssa_liveness_d> ssa_live;
+static TLS std::vector<cfg_ht> rpo;
+
+// Exact number of values live at each CFG node, indexed by 'rpo_index'.
+// (These are copied into 'in_popcount' and 'out_popcount' at the same
+//  points the dense representation recomputes them.)
+static TLS std::vector<unsigned> in_count;
+static TLS std::vector<unsigned> out_count;
+
+// Scratch sets, indexed by 'rpo_index', used to build a single node's intervals.
+static TLS std::vector<bitset_uint_t> scratch_in;
+static TLS std::vector<bitset_uint_t> scratch_out;
+static TLS std::vector<unsigned> touched_in;
+static TLS std::vector<unsigned> touched_out;
+
+static inline cfg_liveness_d& live(cfg_ht h)
+{
+    return cg_data(h).live;
+}
+
+static bool interval_test(live_interval_t const* intervals, unsigned size, unsigned i)
+{
+    // Find the first interval ending after 'i':
+    live_interval_t const* it = std::upper_bound(
+        intervals, intervals + size, i,
+        [](unsigned i, live_interval_t const& interval) { return i < interval.end; });
+    return it != intervals + size && it->begin <= i;
+}
+
+static void build_rpo(ir_t const& ir)
+{
+    rpo.clear();
+
+    for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+        live(cfg_it).rpo_index = UINT_MAX;
+
+    // Iterative DFS, producing postorder into 'rpo':
+    static TLS std::vector<std::pair<cfg_ht, unsigned>> stack;
+    stack.clear();
+
+    auto const visit = [&](cfg_ht cfg)
+    {
+        if(live(cfg).rpo_index != UINT_MAX)
+            return;
+        live(cfg).rpo_index = 0; // Mark as visited.
+        stack.push_back({ cfg, 0 });
+
+        while(!stack.empty())
+        {
+            auto& [node, i] = stack.back();
+            if(i < node->output_size())
+            {
+                cfg_ht const output = node->output(i++);
+                if(live(output).rpo_index == UINT_MAX)
+                {
+                    live(output).rpo_index = 0;
+                    stack.push_back({ output, 0 });
+                }
+            }
+            else
+            {
+                rpo.push_back(node);
+                stack.pop_back();
+            }
+        }
+    };
+
+    visit(ir.root);
+
+    // Catch anything unreachable, for robustness.
+    for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+        visit(cfg_it);
+
+    std::reverse(rpo.begin(), rpo.end());
+    for(unsigned i = 0; i < rpo.size(); ++i)
+        live(rpo[i]).rpo_index = i;
+}
+
+static void mark(std::vector<bitset_uint_t>& scratch, std::vector<unsigned>& touched, unsigned i)
+{
+    if(!bitset_test(scratch.data(), i))
+    {
+        bitset_set(scratch.data(), i);
+        touched.push_back(i);
+    }
+}
+
+// Loads a node's existing intervals into the scratch sets.
+static void begin_sparse(ssa_ht node)
+{
+    assert(touched_in.empty() && touched_out.empty());
+    ssa_liveness_d const& d = ssa_live[node.id];
+
+    for(unsigned i = 0; i < d.in_size; ++i)
+    for(unsigned j = d.in[i].begin; j < d.in[i].end; ++j)
+    {
+        mark(scratch_in, touched_in, j);
+        --in_count[j];
+    }
+
+    for(unsigned i = 0; i < d.out_size; ++i)
+    for(unsigned j = d.out[i].begin; j < d.out[i].end; ++j)
+    {
+        mark(scratch_out, touched_out, j);
+        --out_count[j];
+    }
+}
+
+static live_interval_t const* to_intervals(std::vector<bitset_uint_t>& scratch, std::vector<unsigned>& touched,
+                                           std::vector<unsigned>& count, unsigned& size)
+{
+    static TLS std::vector<live_interval_t> intervals;
+    intervals.clear();
+
+    std::sort(touched.begin(), touched.end());
+    for(unsigned i : touched)
+    {
+        bitset_clear(scratch.data(), i);
+        ++count[i];
+
+        if(!intervals.empty() && intervals.back().end == i)
+            ++intervals.back().end;
+        else
+            intervals.push_back({ i, i + 1 });
+    }
+    touched.clear();
+
+    size = intervals.size();
+    return interval_pool.insert(intervals.begin(), intervals.end());
+}
+
+// Converts the scratch sets back into intervals.
+static void end_sparse(ssa_ht node)
+{
+    ssa_liveness_d& d = ssa_live[node.id];
+    d.in  = to_intervals(scratch_in,  touched_in,  in_count,  d.in_size);
+    d.out = to_intervals(scratch_out, touched_out, out_count, d.out_size);
+}
+
+static void update_popcounts(ir_t const& ir)
+{
+    using namespace liveness_impl;
+
+    if(sparse)
+    {
+        for(unsigned i = 0; i < rpo.size(); ++i)
+        {
+            auto& d = live(rpo[i]);
+            d.in_popcount  = in_count[i];
+            d.out_popcount = out_count[i];
+        }
+    }
+    else
+    {
+        for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+        {
+            auto& d = live(cfg_it);
+            d.in_popcount  = bitset_popcount(set_size, d.in);
+            d.out_popcount = bitset_popcount(set_size, d.out);
+        }
+    }
 }
 
 //////////////////
 // cfg liveness //
 //////////////////
 
-static inline cfg_liveness_d& live(cfg_ht h) 
-{ 
-    return cg_data(h).live;
+bool live_in(cfg_ht cfg, ssa_ht h)
+{
+    if(liveness_impl::sparse)
+    {
+        ssa_liveness_d const& d = ssa_live[h.id];
+        return interval_test(d.in, d.in_size, live(cfg).rpo_index);
+    }
+    return bitset_test(live(cfg).in, h.id);
+}
+
+bool live_out(cfg_ht cfg, ssa_ht h)
+{
+    if(liveness_impl::sparse)
+    {
+        ssa_liveness_d const& d = ssa_live[h.id];
+        return interval_test(d.out, d.out_size, live(cfg).rpo_index);
+    }
+    return bitset_test(live(cfg).out, h.id);
+}
+
+static void set_live_in(cfg_ht cfg, ssa_ht h)
+{
+    if(liveness_impl::sparse)
+        mark(scratch_in, touched_in, live(cfg).rpo_index);
+    else
+        bitset_set(live(cfg).in, h.id);
+}
+
+static void set_live_out(cfg_ht cfg, ssa_ht h)
+{
+    if(liveness_impl::sparse)
+        mark(scratch_out, touched_out, live(cfg).rpo_index);
+    else
+        bitset_set(live(cfg).out, h.id);
+}
+
+static bool test_live_in(cfg_ht cfg, ssa_ht h)
+{
+    if(liveness_impl::sparse)
+        return bitset_test(scratch_in.data(), live(cfg).rpo_index);
+    return bitset_test(live(cfg).in, h.id);
 }
 
 static void _live_visit(ssa_ht def, cfg_ht cfg_node)
@@ -29,26 +264,29 @@ static void _live_visit(ssa_ht def, cfg_ht cfg_node)
     if(def->cfg_node() == cfg_node)
         return;
 
-    if(bitset_test(live(cfg_node).in, def.id))
+    if(test_live_in(cfg_node, def))
         return;
 
-    bitset_set(live(cfg_node).in, def.id);
+    set_live_in(cfg_node, def);
 
     unsigned const input_size = cfg_node->input_size();
     passert(input_size > 0, cfg_node, input_size);
     for(unsigned i = 0; i < input_size; ++i)
     {
         cfg_ht input = cfg_node->input(i);
-        bitset_set(live(input).out, def.id);
+        set_live_out(input, def);
         _live_visit(def, input);
     }
 }
 
 void calc_ssa_liveness(ssa_ht node)
 {
-    passert(liveness_impl::reserved_size >= ssa_data_pool::array_size(), 
+    passert(liveness_impl::reserved_size >= ssa_data_pool::array_size(),
             liveness_impl::reserved_size, ssa_data_pool::array_size());
 
+    if(liveness_impl::sparse)
+        begin_sparse(node);
+
     unsigned const output_size = node->output_size();
     for(unsigned i = 0; i < output_size; ++i)
     {
@@ -65,7 +303,7 @@ void calc_ssa_liveness(ssa_ht node)
             assert(node->cfg_node() == ocfg->input(oe.index));
 
             //bitset_set(live(ocfg).in, node.index);
-            bitset_set(live(node->cfg_node()).out, node.id);
+            set_live_out(node->cfg_node(), node);
             //_live_visit(node, node->cfg_node());
         }
         else
@@ -74,6 +312,9 @@ void calc_ssa_liveness(ssa_ht node)
             _live_visit(node, ocfg);
         }
     }
+
+    if(liveness_impl::sparse)
+        end_sparse(node);
 }
 
 unsigned calc_ssa_liveness(ir_t const& ir)
@@ -86,29 +327,45 @@ unsigned calc_ssa_liveness(ir_t const& ir, unsigned pool_size)
     using namespace liveness_impl;
     cg_data_resize();
     bitset_pool.clear();
+    interval_pool.clear();
     assert(pool_size >= ssa_data_pool::array_size());
     reserved_size = pool_size;
     set_size = ::bitset_size<>(pool_size);
+    sparse = std::size_t(set_size) * ir.cfg_size() * 2 > SPARSE_THRESHOLD;
 
-    for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+    if(sparse)
     {
-        auto& d = live(cfg_it);
-        d.in  = bitset_pool.alloc(set_size);
-        d.out = bitset_pool.alloc(set_size);
-        assert(d.in);
-        assert(d.out);
+        build_rpo(ir);
+
+        ssa_live.assign(pool_size, {});
+        in_count.assign(rpo.size(), 0);
+        out_count.assign(rpo.size(), 0);
+        scratch_in.assign(::bitset_size<>(rpo.size()), 0);
+        scratch_out.assign(::bitset_size<>(rpo.size()), 0);
+
+        for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+        {
+            auto& d = live(cfg_it);
+            d.in = d.out = nullptr;
+        }
+    }
+    else
+    {
+        for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+        {
+            auto& d = live(cfg_it);
+            d.in  = bitset_pool.alloc(set_size);
+            d.out = bitset_pool.alloc(set_size);
+            assert(d.in);
+            assert(d.out);
+        }
     }
 
     for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
     for(ssa_ht ssa_it = cfg_it->ssa_begin(); ssa_it; ++ssa_it)
         calc_ssa_liveness(ssa_it);
 
-    for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
-    {
-        auto& d = live(cfg_it);
-        d.in_popcount  = bitset_popcount(set_size, d.in);
-        d.out_popcount = bitset_popcount(set_size, d.out);
-    }
+    update_popcounts(ir);
 
     return set_size;
 }
@@ -119,14 +376,29 @@ void clear_liveness_for(ir_t const& ir, ssa_ht node)
             liveness_impl::reserved_size, ssa_data_pool::array_size());
 
     using namespace liveness_impl;
-    for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+
+    if(sparse)
     {
-        auto& d = live(cfg_it);
-        bitset_clear(d.in, node.id);
-        bitset_clear(d.out, node.id);
-        d.in_popcount  = bitset_popcount(set_size, d.in);
-        d.out_popcount = bitset_popcount(set_size, d.out);
+        begin_sparse(node);
+        for(unsigned i : touched_in)
+            bitset_clear(scratch_in.data(), i);
+        for(unsigned i : touched_out)
+            bitset_clear(scratch_out.data(), i);
+        touched_in.clear();
+        touched_out.clear();
+        ssa_live[node.id] = {};
     }
+    else
+    {
+        for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
+        {
+            auto& d = live(cfg_it);
+            bitset_clear(d.in, node.id);
+            bitset_clear(d.out, node.id);
+        }
+    }
+
+    update_popcounts(ir);
 }
 
 bool live_at_def(ssa_ht range, ssa_ht def)
@@ -135,14 +407,14 @@ bool live_at_def(ssa_ht range, ssa_ht def)
         return false;
 
     bool const same_cfg = range->cfg_node() == def->cfg_node();
-    auto const& def_live = live(def->cfg_node()); 
+    cfg_ht const def_cfg = def->cfg_node();
 
     // If 'range' begins before 'def':
     if((same_cfg && cg_data(range).schedule.index <= cg_data(def).schedule.index)
-       || bitset_test(def_live.in, range.id))
+       || live_in(def_cfg, range))
     {
         // Interfere if range is also live-out at def.
-        if(bitset_test(def_live.out, range.id))
+        if(live_out(def_cfg, range))
             return true;
 
         // Test to see if a use occurs after def:
@@ -183,6 +455,21 @@ std::size_t live_range_busyness(ir_t& ir, ssa_ht h)
 
     std::size_t total_size = 0;
 
+    if(sparse)
+    {
+        ssa_liveness_d const& d = ssa_live[h.id];
+
+        for(unsigned i = 0; i < d.in_size; ++i)
+        for(unsigned j = d.in[i].begin; j < d.in[i].end; ++j)
+            total_size += live(rpo[j]).in_popcount;
+
+        for(unsigned i = 0; i < d.out_size; ++i)
+        for(unsigned j = d.out[i].begin; j < d.out[i].end; ++j)
+            total_size += live(rpo[j]).out_popcount;
+
+        return total_size;
+    }
+
     for(cfg_ht cfg_it = ir.cfg_begin(); cfg_it; ++cfg_it)
     {
         auto& ld = live(cfg_it);
@@ -199,4 +486,3 @@ std::size_t live_range_busyness(ir_t& ir, ssa_ht h)
 
     return total_size;
 }
-
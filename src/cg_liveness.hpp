@@ -2,6 +2,8 @@
 #define CG_LIVENESS_HPP
 
 // A self-contained implementation of live variable analysis.
+// Small functions store dense live sets per CFG node.
+// Large ones store sparse intervals per SSA node instead.
 
 #include "array_pool.hpp"
 #include "bitset.hpp"
@@ -15,6 +17,7 @@ namespace liveness_impl
     extern TLS array_pool_t<bitset_uint_t> bitset_pool;
     extern TLS unsigned set_size;
     extern TLS unsigned reserved_size;
+    extern TLS bool sparse; // If the sparse representation is in use.
 }
 
 inline unsigned live_set_size() { return liveness_impl::set_size; }
@@ -25,6 +28,10 @@ unsigned calc_ssa_liveness(ir_t const& ir, unsigned pool_size);
 
 void clear_liveness_for(ir_t const& ir, ssa_ht node);
 
+// If 'h' is live on entry to / exit from 'cfg'.
+bool live_in(cfg_ht cfg, ssa_ht h);
+bool live_out(cfg_ht cfg, ssa_ht h);
+
 // If 'range' intersects 'def'.
 bool live_at_def(ssa_ht range, ssa_ht def);
 
@@ -246,15 +246,12 @@ locator_t cg_calc_bank_switches(fn_ht fn, ir_t& ir)
 
             // Update 'd.in':
 
-            bitset_copy(bs_size, bs_temp, d.in);
-
+            bool in_changed = false;
             for(unsigned i = 0; i < output_size; ++i)
-                bitset_or(bs_size, bs_temp, cg_data(cfg->output(i)).banks.in);
+                in_changed |= bitset_or_changed(bs_size, d.in, cg_data(cfg->output(i)).banks.in);
 
-            if(!bitset_eq(bs_size, bs_temp, d.in))
+            if(in_changed)
             {
-                bitset_copy(bs_size, d.in, bs_temp);
-
                 for(unsigned i = 0; i < input_size; ++i)
                 {
                     cfg_ht const input = cfg->input(i);
@@ -265,15 +262,12 @@ locator_t cg_calc_bank_switches(fn_ht fn, ir_t& ir)
 
             // Update 'd.out':
 
-            bitset_copy(bs_size, bs_temp, d.out);
-
+            bool out_changed = false;
             for(unsigned i = 0; i < input_size; ++i)
-                bitset_or(bs_size, bs_temp, cg_data(cfg->input(i)).banks.out);
+                out_changed |= bitset_or_changed(bs_size, d.out, cg_data(cfg->input(i)).banks.out);
 
-            if(!bitset_eq(bs_size, bs_temp, d.out))
+            if(out_changed)
             {
-                bitset_copy(bs_size, d.out, bs_temp);
-
                 for(unsigned i = 0; i < output_size; ++i)
                 {
                     cfg_ht const output = cfg->output(i);
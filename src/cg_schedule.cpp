@@ -1,5 +1,6 @@
 #include "cg_schedule.hpp"
 
+#include <array>
 #include <vector>
 #ifndef NDEBUG
 #include <iostream>
@@ -44,12 +45,38 @@ private:
     // Each SSA node in the CFG node that has been scheduled.
     bitset_uint_t* scheduled = nullptr;
 
+    // As 'scheduled' only grows, a word of deps that was scheduled stays so.
+    // Per 'bs_index', this tracks the first word of deps that might not be,
+    // letting 'ready' resume from it.
+    mutable std::vector<unsigned> deps_word;
+
+    // The unscheduled SSA nodes, in the order of the CFG node's SSA list.
+    // Scheduled nodes are removed by 'full_search'.
+    std::vector<ssa_ht> unscheduled;
+
+    // Path lengths only depend on the scheduler's state,
+    // so each is computed once per step, for each relax level.
+    struct path_memo_t
+    {
+        unsigned step = 0;
+        int length = 0;
+    };
+    std::vector<std::array<path_memo_t, 3>> path_memo; // Indexed by 'bs_index'.
+    unsigned step = 0;
+
+    // Scratch space for 'path_length':
+    bitset_uint_t* path_set = nullptr;
+
     // All the SSA nodes that maybe clobber the carry.
     bitset_uint_t* carry_clobberers = nullptr;
 
     // The SSA nodes after topological sorting:
     std::vector<ssa_ht> toposorted;
 
+    // Scratch space for 'add_dep':
+    bitset_uint_t* delta = nullptr;
+    std::vector<unsigned> delta_words;
+
     inline ssa_schedule_d& data(ssa_ht h) const { return cg_data(h).schedule; }
     inline int& bs_index(ssa_ht h) const { return data(h).bitset_index; }
 
@@ -59,7 +86,8 @@ private:
     
     bool ready(unsigned relax, ssa_ht h, bitset_uint_t const* scheduled) const;
 
-    int path_length(unsigned relax, ssa_ht h, bitset_uint_t const* scheduled, int depth = 0) const;
+    int path_length(unsigned relax, ssa_ht h, bitset_uint_t* path_set, int depth = 0) const;
+    int memo_path_length(unsigned relax, ssa_ht h);
     int indexer_score(ssa_ht h) const;
     int banker_score(ssa_ht h) const;
 
@@ -69,6 +97,8 @@ private:
 
     void calc_exit_distance(ssa_ht ssa, int exit_distance=0) const;
 
+    void add_dep(ssa_ht node, ssa_ht dep);
+
     void add_array_bs_index(ssa_value_t index)
     {
         if(array_indexers[0] == index)
@@ -85,18 +115,74 @@ private:
 
 // 'exit_distance' will penalize nodes used by the exit SSA node,
 // causing their work to be done closer to the exit.
+// The distances are found breadth-first, so that each node
+// is visited once per call, rather than once per path.
 void scheduler_t::calc_exit_distance(ssa_ht ssa, int exit_distance) const
 {
-    if(ssa->cfg_node() != cfg_node)
-        return;
+    static TLS std::vector<ssa_ht> next;
+    static TLS std::vector<ssa_ht> current;
 
-    if(data(ssa).exit_distance <= exit_distance)
-        return;
+    auto const visit = [&](ssa_ht h)
+    {
+        if(h->cfg_node() != cfg_node)
+            return;
+
+        if(data(h).exit_distance <= exit_distance)
+            return;
+
+        data(h).exit_distance = exit_distance;
+
+        if(h->op() != SSA_phi)
+            next.push_back(h);
+    };
 
-    data(ssa).exit_distance = exit_distance++;
+    next.clear();
+    visit(ssa);
 
-    if(ssa->op() != SSA_phi)
-        for_each_node_input(ssa, [&](ssa_ht input){ calc_exit_distance(input, exit_distance); });
+    while(!next.empty())
+    {
+        ++exit_distance;
+        current.swap(next);
+        next.clear();
+        for(ssa_ht h : current)
+            for_each_node_input(h, visit);
+    }
+}
+
+// Makes 'node' depend on 'dep', and on everything 'dep' depends on.
+// Deps are kept transitively closed, so nodes depending on 'node'
+// gain the same deps. As every such node already has the old deps
+// of 'node', only the words that changed are passed along.
+void scheduler_t::add_dep(ssa_ht node, ssa_ht dep)
+{
+    auto& d = data(node);
+
+    bitset_copy(set_size, delta, data(dep).deps);
+    bitset_set(delta, bs_index(dep));
+
+    delta_words.clear();
+    for(unsigned i = 0; i < set_size; ++i)
+    {
+        delta[i] &= ~d.deps[i];
+        if(delta[i])
+        {
+            d.deps[i] |= delta[i];
+            delta_words.push_back(i);
+        }
+    }
+
+    if(delta_words.empty())
+        return;
+
+    unsigned const node_i = bs_index(node);
+    for(ssa_ht ssa_node : toposorted)
+    {
+        auto& od = data(ssa_node);
+        assert(od.deps);
+        if(bitset_test(od.deps, node_i))
+            for(unsigned i : delta_words)
+                od.deps[i] |= delta[i];
+    }
 }
 
 scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
@@ -113,6 +199,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
     passert(toposorted.size() == cfg_node->ssa_size(), toposorted.size(), ir.ssa_size());
 
     scheduled = bitset_pool.alloc(set_size);
+    path_set = bitset_pool.alloc(set_size);
 
     for(unsigned i = 0; i < toposorted.size(); ++i)
     {
@@ -187,16 +274,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             bitset_set(carry_clobberers, bs_index(ssa_node));
 
     // Now add extra deps to aid scheduling efficiency.
-    auto propagate_deps_change = [&](ssa_ht changed)
-    {
-        for(ssa_ht ssa_node : toposorted)
-        {
-            auto& d = data(ssa_node);
-            assert(d.deps);
-            if(bitset_test(d.deps, bs_index(changed)))
-                bitset_or(set_size, d.deps, data(changed).deps);
-        }
-    };
+    delta = bitset_pool.alloc(set_size);
 
     read_map.clear();
     write_map.clear();
@@ -234,27 +312,17 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             bitset_for_each(set_size, pair.second, [&](unsigned write_i)
             {
                 ssa_ht const write = toposorted[write_i];
-                bool updated = false;
 
                 bitset_for_each(set_size, temp_set, [&](unsigned read_i)
                 {
                     ssa_ht const read = toposorted[read_i];
 
-                    auto& rd = data(read);
-                    auto& wd = data(write);
-
                     // Can't add a dep if a cycle would be created:
-                    if(bitset_test(rd.deps, write_i))
+                    if(bitset_test(data(read).deps, write_i))
                         return;
 
-                    // Add a dep!
-                    bitset_set(wd.deps, read_i);
-                    bitset_or(set_size, wd.deps, rd.deps);
-                    updated = true;
+                    add_dep(write, read);
                 });
-
-                if(updated)
-                    propagate_deps_change(write);
             });
         }
     }
@@ -275,7 +343,6 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
         unsigned const index_ = bs_index(writer);
 
         // - identify if the writer depends on other writes
-        bool updated = false;
 
         bitset_for_each(set_size, d.deps, 
         [&](unsigned bit)
@@ -300,15 +367,9 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
                 if(bitset_test(od.deps, index_))
                     return;
 
-                // Add a dep!
-                bitset_set(d.deps, bs_index(o));
-                bitset_or(set_size, d.deps, od.deps);
-                updated = true;
+                add_dep(writer, o);
             }
         });
-
-        if(updated)
-            propagate_deps_change(writer);
     }
 
     // In chains of carry operations, setup deps to avoid cases where
@@ -358,8 +419,6 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             temp_set[i] = user_d.deps[i] & ~d.deps[i] & carry_clobberers[i];
         bitset_clear(temp_set, index_);
 
-        bool updated = false;
-
         bitset_for_each(set_size, temp_set, 
         [&](unsigned bit)
         { 
@@ -372,14 +431,8 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             if(bitset_test(od.deps, index_))
                 return;
 
-            // Add a dep!
-            bitset_set(d.deps, bit);
-            bitset_or(set_size, d.deps, od.deps);
-            updated = true;
+            add_dep(ssa_node, toposorted[bit]);
         });
-
-        if(updated)
-            propagate_deps_change(ssa_node);
     }
 
     for(auto it = toposorted.rbegin(); it != toposorted.rend(); ++it)
@@ -397,7 +450,6 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
         // OK! This node produces a carry used by a single output.
 
         auto& carry_d = data(carry);
-        auto& d = data(ssa_node);
         unsigned const index_ = bs_index(ssa_node);
 
         // When a node outputs a carry, 
@@ -414,8 +466,6 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
         assert(!bitset_test(temp_set, index_));
         assert(!bitset_test(temp_set, bs_index(carry)));
 
-        bool updated = false;
-
         bitset_for_each(set_size, temp_set, 
         [&](unsigned bit)
         { 
@@ -428,22 +478,14 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             if(bitset_test(od.deps, index_))
                 return;
 
-            // Add a dep!
-            bitset_set(d.deps, bit);
-            bitset_or(set_size, d.deps, od.deps);
-            updated = true;
+            add_dep(ssa_node, toposorted[bit]);
         });
-
-        if(updated)
-            propagate_deps_change(ssa_node);
     }
 
     // If a node's result will be stored in a locator eventually,
     // it should come after previous writes/reads to that locator.
     for(ssa_ht ssa_node : toposorted)
     {
-        auto& d = data(ssa_node);
-
         for(unsigned i = 0; i < ssa_node->output_size(); ++i)
         {
             auto oe = ssa_node->output_edge(i);
@@ -475,10 +517,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
                     if(bitset_test(data(daisy).deps, bs_index(ssa_node)))
                         break;
 
-                    // Add a dep!
-                    bitset_set(d.deps, bs_index(daisy));
-                    bitset_or(set_size, d.deps, data(daisy).deps);
-                    propagate_deps_change(ssa_node);
+                    add_dep(ssa_node, daisy);
 
                     break;
                 }
@@ -502,8 +541,6 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             // For tight self-loops, phis should be used before they are re-written.
             if(is_phi && same_cfg)
             {
-                auto& d = data(ssa_node);
-
                 for_each_output(output, [&](ssa_ht phi_output)
                 {
                     if(phi_output->cfg_node() != cfg_node)
@@ -516,10 +553,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
                     if(bitset_test(data(phi_output).deps, bs_index(ssa_node)))
                         return;
 
-                    // Add a dep!
-                    bitset_set(d.deps, bs_index(phi_output));
-                    bitset_or(set_size, d.deps, data(phi_output).deps);
-                    propagate_deps_change(ssa_node);
+                    add_dep(ssa_node, phi_output);
                 });
             }
 
@@ -540,8 +574,6 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
         if(!(ssa_flags(ssa_node->op()) & SSAF_WRITE_ARRAY))
             continue;
 
-        auto& d = data(ssa_node);
-
         if(!ssa_node->input(ARRAY).holds_ref())
             continue;
         ssa_ht const array_input = ssa_node->input(ARRAY).handle();
@@ -565,10 +597,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             if(bitset_test(data(read).deps, bs_index(ssa_node)))
                 return;
 
-            // Add a dep!
-            bitset_set(d.deps, bs_index(read));
-            bitset_or(set_size, d.deps, data(read).deps);
-            propagate_deps_change(ssa_node);
+            add_dep(ssa_node, read);
 
             // We'll also try to schedule read's outputs before the write.
             // This improves code gen!
@@ -586,10 +615,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
                 if(bitset_test(data(output).deps, bs_index(ssa_node)))
                     return;
 
-                // Add a dep!
-                bitset_set(d.deps, bs_index(output));
-                bitset_or(set_size, d.deps, data(output).deps);
-                propagate_deps_change(ssa_node);
+                add_dep(ssa_node, output);
 
             });
         });
@@ -627,11 +653,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             if(bitset_test(d.deps, bs_index(use)))
                 return;
 
-            // Add a dep!
-            auto& ud = data(use);
-            bitset_set(ud.deps, bs_index(ssa_node));
-            bitset_or(set_size, ud.deps, d.deps);
-            propagate_deps_change(use);
+            add_dep(use, ssa_node);
         });
     }
 
@@ -661,11 +683,7 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
                 if(bitset_test(data(ssa_node).deps, bs_index(output)))
                     continue;
 
-                // Add a dep!
-                auto& d = data(output);
-                bitset_set(d.deps, bs_index(ssa_node));
-                bitset_or(set_size, d.deps, data(ssa_node).deps);
-                propagate_deps_change(output);
+                add_dep(output, ssa_node);
             }
         }
     }
@@ -703,16 +721,11 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
                 if(copy_output == ptr_output)
                     continue;
 
-                auto& d = data(copy_output);
-
                 // Can't add a dep if a cycle would be created:
                 if(bitset_test(data(ptr_output).deps, bs_index(copy_output)))
                     continue;
 
-                // Add a dep!
-                bitset_set(d.deps, bs_index(ptr_output));
-                bitset_or(set_size, d.deps, data(ptr_output).deps);
-                propagate_deps_change(copy_output);
+                add_dep(copy_output, ptr_output);
             }
         }
     }
@@ -744,16 +757,11 @@ scheduler_t::scheduler_t(ir_t& ir, cfg_ht cfg_node_)
             if(oe.handle->cfg_node() != cfg_node)
                 continue;
 
-            auto& d = data(oe.handle);
-
             // Can't add a dep if a cycle would be created:
             if(bitset_test(data(ssa_node).deps, bs_index(oe.handle)))
                 continue;
 
-            // Add a dep!
-            bitset_set(d.deps, bs_index(ssa_node));
-            bitset_or(set_size, d.deps, data(ssa_node).deps);
-            propagate_deps_change(oe.handle);
+            add_dep(oe.handle, ssa_node);
         }
     }
 
@@ -852,6 +860,13 @@ void scheduler_t::run()
     assert(bitset_all_clear(set_size, scheduled));
     assert(unused_global_reads.empty());
 
+    deps_word.assign(toposorted.size(), 0);
+    path_memo.assign(toposorted.size(), {});
+
+    unscheduled.clear();
+    for(ssa_ht ssa_it = cfg_node->ssa_begin(); ssa_it; ++ssa_it)
+        unscheduled.push_back(ssa_it);
+
     if(Fast)
         std::reverse(toposorted.begin(), toposorted.end());
 
@@ -867,6 +882,9 @@ void scheduler_t::run()
 
     while(schedule.size() < cfg_node->ssa_size())
     {
+        // Invalidate 'path_memo':
+        ++step;
+
         // First priority: try to find a successor node that's ready:
         if(candidate)
             candidate = successor_search(candidate);
@@ -939,9 +957,19 @@ bool scheduler_t::ready(unsigned relax, ssa_ht h, bitset_uint_t const* scheduled
         return false;
 
     // A node is ready when all of its inputs are scheduled.
-    for(unsigned i = 0; i < set_size; ++i)
-        if(d.deps[i] & ~scheduled[i])
-            return false;
+    if(scheduled == this->scheduled)
+    {
+        unsigned& word = deps_word[bs_index(h)];
+        for(; word < set_size; ++word)
+            if(d.deps[word] & ~scheduled[word])
+                return false;
+    }
+    else
+    {
+        for(unsigned i = 0; i < set_size; ++i)
+            if(d.deps[i] & ~scheduled[i])
+                return false;
+    }
 
     if(relax >= 2)
         return true;
@@ -961,13 +989,9 @@ bool scheduler_t::ready(unsigned relax, ssa_ht h, bitset_uint_t const* scheduled
 
 // Estimates how many operations can be chained together.
 // The score is used to weight different nodes for scheduling.
-int scheduler_t::path_length(unsigned relax, ssa_ht h, bitset_uint_t const* scheduled, int depth) const
+// 'path_set' holds the scheduled nodes, and is restored before returning.
+int scheduler_t::path_length(unsigned relax, ssa_ht h, bitset_uint_t* path_set, int depth) const
 {
-    auto* new_bitset = ALLOCA_T(bitset_uint_t, set_size);
-    bitset_copy(set_size, new_bitset, scheduled);
-    // 'new_bitset' assumes 'h' will be scheduled:
-    bitset_set(new_bitset, bs_index(h));
-
     if(ssa_flags(h->op()) & SSAF_PRIO_SCHEDULE)
         return 0;
 
@@ -975,6 +999,10 @@ int scheduler_t::path_length(unsigned relax, ssa_ht h, bitset_uint_t const* sche
     int const STOP_POINT = 8;
     if(depth >= STOP_POINT)
         return 0;
+
+    // 'path_set' assumes 'h' will be scheduled:
+    assert(!bitset_test(path_set, bs_index(h)));
+    bitset_set(path_set, bs_index(h));
     
     int max_length = 0;
     int outputs_in_cfg_node = 0; // Number of outputs in the same CFG node.
@@ -986,7 +1014,7 @@ int scheduler_t::path_length(unsigned relax, ssa_ht h, bitset_uint_t const* sche
         if(oe.handle->cfg_node() != cfg_node)
             continue;
 
-        if(!ready(relax, oe.handle, new_bitset))
+        if(!ready(relax, oe.handle, path_set))
         {
             // TODO
             //if((ssa_flags(oe.handle->op()) & SSAF_INDEXES_ARRAY) && oe.index == 2)
@@ -1001,19 +1029,37 @@ int scheduler_t::path_length(unsigned relax, ssa_ht h, bitset_uint_t const* sche
         if(oe.input_class() == INPUT_VALUE)
             ++outputs_in_cfg_node;
 
-        int const l = path_length(relax, oe.handle, new_bitset, depth + 1);
+        int const l = path_length(relax, oe.handle, path_set, depth + 1);
 
         //assert(l >= 0);
         if(l < 0) // Only enable this if -1 can be returned.
+        {
+            bitset_clear(path_set, bs_index(h));
             return l;
+        }
 
         max_length = std::max(max_length, l);
     }
 
+    bitset_clear(path_set, bs_index(h));
 
     return (max_length + std::max<int>(0, outputs_in_cfg_node - 1));
 }
 
+int scheduler_t::memo_path_length(unsigned relax, ssa_ht h)
+{
+    path_memo_t& memo = path_memo[bs_index(h)][std::min(relax, 2u)];
+
+    if(memo.step != step)
+    {
+        bitset_copy(set_size, path_set, scheduled);
+        memo.length = path_length(relax, h, path_set);
+        memo.step = step;
+    }
+
+    return memo.length;
+}
+
 // Estimates if an array operation should be scheduled.
 // The score is used to weight different nodes for scheduling.
 int scheduler_t::indexer_score(ssa_ht h) const
@@ -1068,7 +1114,7 @@ ssa_ht scheduler_t::successor_search(ssa_ht last_scheduled)
             }
 
             // Otherwise find the best successor node by comparing path lengths:
-            int score = path_length(0, succ, this->scheduled);
+            int score = memo_path_length(0, succ);
             score += indexer_score(succ);
             score += banker_score(succ);
 
@@ -1103,8 +1149,14 @@ ssa_ht scheduler_t::full_search(unsigned relax)
     int best_score = INT_MIN;
     ssa_ht best = {};
 
-    for(ssa_ht ssa_it = cfg_node->ssa_begin(); ssa_it; ++ssa_it)
+    // Remove scheduled nodes from 'unscheduled' while iterating it:
+    unsigned kept = 0;
+    for(ssa_ht ssa_it : unscheduled)
     {
+        if(bitset_test(scheduled, bs_index(ssa_it)))
+            continue;
+        unscheduled[kept++] = ssa_it;
+
         if(!ready(relax, ssa_it, scheduled))
             continue;
 
@@ -1115,7 +1167,7 @@ ssa_ht scheduler_t::full_search(unsigned relax)
         else
         {
             // Fairly arbitrary formula.
-            score = path_length(relax, ssa_it, scheduled);
+            score = memo_path_length(relax, ssa_it);
             score += indexer_score(ssa_it);
             score += banker_score(ssa_it);
         }
@@ -1129,6 +1181,7 @@ ssa_ht scheduler_t::full_search(unsigned relax)
             best = ssa_it;
         }
     }
+    unscheduled.resize(kept);
 
     if(best)
     {
@@ -19,6 +19,7 @@
 #  include <unistd.h>
 #endif
 
+#include "build_cache.hpp"
 #include "guard.hpp"
 #include "format.hpp"
 #include "compiler_error.hpp"
@@ -88,24 +89,25 @@ std::pair<unsigned, unsigned> finalize_macros()
 
 bool resource_path(fs::path preferred_dir, fs::path name, fs::path& result)
 {
-    result = preferred_dir / name;
+    auto const iter = [&](fs::path const& dir) -> bool
+    {
+        result = dir / name;
+        if(fs::exists(result))
+            return true;
+        build_cache_record_absent(result);
+        return false;
+    };
 
-    if(fs::exists(result))
+    if(iter(preferred_dir))
         return true;
 
     for(fs::path const& dir : compiler_options().resource_dirs)
-    {
-        result = dir / name;
-        if(fs::exists(result))
+        if(iter(dir))
             return true;
-    }
 
     for(fs::path const& dir : compiler_options().nesfab_dirs)
-    {
-        result = dir / name;
-        if(fs::exists(result))
+        if(iter(dir))
             return true;
-    }
 
     return false;
 }
@@ -125,6 +127,7 @@ bool read_binary_file(char const* filename, std::function<void*(std::size_t)> co
     if(!data || read(fd, data, sb.st_size) != sb.st_size)
         return false;
 
+    build_cache_record_read(filename, data, sb.st_size);
     return data;
 #else
     FILE* fp = std::fopen(filename, "rb");
@@ -142,6 +145,7 @@ bool read_binary_file(char const* filename, std::function<void*(std::size_t)> co
     if(!data || std::fread(data, file_size, 1, fp) != 1)
         return false;
 
+    build_cache_record_read(filename, data, file_size);
     return data;
 #endif
 }
@@ -187,7 +191,10 @@ fs::path source_path(unsigned file_i)
     auto const iter = [&](fs::path const& dir) -> bool
     {
         path = dir / source.file;
-        return fs::exists(path);
+        if(fs::exists(path))
+            return true;
+        build_cache_record_absent(path);
+        return false;
     };
 
     if(iter(source.dir))
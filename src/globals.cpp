@@ -11,6 +11,7 @@
 #include "compiler_error.hpp"
 #include "fnv1a.hpp"
 #include "o.hpp"
+#include "opt_stats.hpp"
 #include "options.hpp"
 #include "byteify.hpp"
 #include "cg.hpp"
@@ -26,6 +27,7 @@
 #include "debug_print.hpp"
 #include "text.hpp"
 #include "switch.hpp"
+#include "trace.hpp"
 
 //////////////
 // global_t //
@@ -318,21 +320,37 @@ void global_t::parse_cleanup()
 template<typename Fn>
 void global_t::do_all(Fn const& fn, bool parallel)
 {
-    {
-        std::lock_guard lock(ready_mutex);
-        globals_left = global_ht::pool().size();
-    }
+    unsigned const num_threads = parallel ? compiler_options().num_threads : 1;
+
+    // Distribute the initially ready globals among the workers,
+    // dealing out the most critical first:
+    std::stable_sort(ready.begin(), ready.end(), [](global_t const* a, global_t const* b)
+        { return a->m_priority > b->m_priority; });
+    num_ready_heaps = num_threads;
+    ready_heaps.reset(new ready_heap_t[num_threads]);
+    for(unsigned i = 0; i < ready.size(); ++i)
+        ready_heaps[i % num_threads].push(ready[i]);
+    ready_count = ready.size();
+    ready.clear();
+
+    globals_left = global_ht::pool().size();
+    num_sleeping = 0;
+
+    std::atomic<unsigned> next_worker_i = 0;
 
     // Spawn threads to compile in parallel:
-    parallelize(parallel ? compiler_options().num_threads : 1,
-    [&fn](std::atomic<bool>& exception_thrown)
+    parallelize(num_threads,
+    [&fn, &next_worker_i](std::atomic<bool>& exception_thrown)
     {
         ssa_pool::init();
         cfg_pool::init();
 
+        worker_index = next_worker_i++;
+        assert(worker_index < num_ready_heaps);
+
         while(!exception_thrown)
         {
-            global_t* global = await_ready_global();
+            global_t* global = await_ready_global(exception_thrown);
 
             if(!global)
                 return;
@@ -343,14 +361,12 @@ void global_t::do_all(Fn const& fn, bool parallel)
     },
     []
     {
-        {
-            std::lock_guard lock(ready_mutex);
-            globals_left = 0;
-        }
-        ready_cv.notify_all();
+        globals_left = 0;
+        notify_ready(true);
     });
 
-    ready_cv.notify_all();
+    ready_heaps.reset();
+    num_ready_heaps = 0;
 }
 
 // This function isn't thread-safe.
@@ -676,6 +692,42 @@ void global_t::build_order()
     }
 
     assert(ready.size());
+
+    // Prioritize globals that start long chains of work:
+    for(global_t& global : global_ht::values())
+        global.m_priority = 0;
+    for(global_t& global : global_ht::values())
+        calc_priority(global);
+}
+
+unsigned global_t::estimated_cost() const
+{
+    switch(gclass())
+    {
+    case GLOBAL_FN:
+        {
+            fn_def_t const& def = impl<fn_t>().def();
+            return 16 + def.stmts.size() * 4 + def.local_vars.size();
+        }
+    case GLOBAL_CONST:
+    case GLOBAL_VAR:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+std::uint64_t global_t::calc_priority(global_t& global)
+{
+    if(global.m_priority)
+        return global.m_priority;
+
+    std::uint64_t longest_iuse = 0;
+    for(global_t* iuse : global.m_iuses)
+        longest_iuse = std::max(longest_iuse, calc_priority(*iuse));
+
+    // 'estimated_cost' is never 0, so neither is 'm_priority' once set.
+    return global.m_priority = global.estimated_cost() + longest_iuse;
 }
 
 global_t* global_t::resolve(log_t* log)
@@ -683,7 +735,10 @@ global_t* global_t::resolve(log_t* log)
     assert(compiler_phase() == PHASE_RESOLVE);
 
     dprint(log, "RESOLVING", name);
-    delegate([](auto& g){ g.resolve(); });
+    {
+        trace_span_t const span("resolve", "global", name);
+        delegate([](auto& g){ g.resolve(); });
+    }
 
 #ifndef NDEBUG
     m_resolved = true;
@@ -696,7 +751,10 @@ global_t* global_t::precheck(log_t* log)
     assert(compiler_phase() == PHASE_PRECHECK);
 
     dprint(log, "PRECHECKING", name);
-    delegate([](auto& g){ g.precheck(); });
+    {
+        trace_span_t const span("precheck", "global", name);
+        delegate([](auto& g){ g.precheck(); });
+    }
 
 #ifndef NDEBUG
     m_prechecked = true;
@@ -709,7 +767,10 @@ global_t* global_t::compile(log_t* log)
     assert(compiler_phase() == PHASE_COMPILE);
 
     dprint(log, "COMPILING", name, m_ideps.size());
-    delegate([](auto& g){ g.compile(); });
+    {
+        trace_span_t const span("compile", "global", name);
+        delegate([](auto& g){ g.compile(); });
+    }
 
 #ifndef NDEBUG
     m_compiled = true;
@@ -730,61 +791,131 @@ global_t* global_t::completed()
             *(newly_ready_end++) = iuse;
 
     std::size_t const newly_ready_size = newly_ready_end - newly_ready;
-    global_t* ret = nullptr;
 
-    if(newly_ready_size == 1)
+    // If an exception was thrown, 'globals_left' was zeroed and we're done.
+    unsigned left = globals_left.load();
+    do if(left == 0) 
+        return nullptr;
+    while(!globals_left.compare_exchange_weak(left, left - 1));
+
+    if(left == 1)
     {
-        ret = newly_ready[0];
-        std::lock_guard lock(ready_mutex);
-        if(globals_left)
-            --globals_left;
+        // That was the last global. Wake everyone so they can exit.
+        notify_ready(true);
+        return nullptr;
     }
-    else if(newly_ready_size == 0)
+
+    if(newly_ready_size > 0)
     {
-        std::lock_guard lock(ready_mutex);
-        if(globals_left)
+        // Share everything, then take back whatever is most critical.
+        // Usually this is one of the globals just pushed.
+        push_ready(worker_index, newly_ready, newly_ready_end);
+        if(newly_ready_size > 1)
+            notify_ready(newly_ready_size > 2);
+    }
+
+    return pop_ready(worker_index);
+}
+
+void global_t::ready_heap_t::push(global_t* global)
+{
+    auto const cmp = [](global_t const* a, global_t const* b) { return a->m_priority < b->m_priority; };
+    heap.push_back(global);
+    std::push_heap(heap.begin(), heap.end(), cmp);
+    top_priority = heap.front()->m_priority;
+}
+
+global_t* global_t::ready_heap_t::pop()
+{
+    if(heap.empty())
+        return nullptr;
+
+    auto const cmp = [](global_t const* a, global_t const* b) { return a->m_priority < b->m_priority; };
+    std::pop_heap(heap.begin(), heap.end(), cmp);
+    global_t* ret = heap.back();
+    heap.pop_back();
+    top_priority = heap.empty() ? 0 : heap.front()->m_priority;
+    return ret;
+}
+
+global_t* global_t::pop_ready(unsigned worker_i)
+{
+    // Try the heaps in order of their top priority, starting with our own.
+    // 'top_priority' is only a hint, so a heap can turn out to be empty once locked.
+    for(unsigned tries = 0; tries < num_ready_heaps; ++tries)
+    {
+        unsigned best_i = worker_i;
+        std::uint64_t best = ready_heaps[worker_i].top_priority;
+
+        for(unsigned i = 1; i < num_ready_heaps; ++i)
         {
-            if(!ready.empty())
+            unsigned const j = (worker_i + i) % num_ready_heaps;
+            std::uint64_t const priority = ready_heaps[j].top_priority;
+            if(priority > best)
             {
-                ret = ready.back();
-                ready.pop_back();
+                best = priority;
+                best_i = j;
             }
-            --globals_left;
         }
-    }
-    else
-    {
-        assert(newly_ready_size > 1);
-        ret = newly_ready[0];
-        ++newly_ready;
 
-        std::lock_guard lock(ready_mutex);
-        if(globals_left)
+        if(best == 0)
+            return nullptr;
+
+        ready_heap_t& rh = ready_heaps[best_i];
+        std::lock_guard lock(rh.mutex);
+        if(global_t* ret = rh.pop())
         {
-            ready.insert(ready.end(), newly_ready, newly_ready_end);
-            --globals_left;
+            --ready_count;
+            return ret;
         }
     }
 
-    if(newly_ready_size == 2)
-        ready_cv.notify_one();
-    else if (newly_ready_size > 2 || globals_left == 0)
-        ready_cv.notify_all();
+    return nullptr;
+}
 
-    return ret;
+void global_t::push_ready(unsigned worker_i, global_t* const* begin, global_t* const* end)
+{
+    ready_heap_t& rh = ready_heaps[worker_i];
+    std::lock_guard lock(rh.mutex);
+    for(global_t* const* it = begin; it != end; ++it)
+        rh.push(*it);
+    ready_count += end - begin;
 }
 
-global_t* global_t::await_ready_global()
+void global_t::notify_ready(bool all)
 {
-    std::unique_lock<std::mutex> lock(ready_mutex);
-    ready_cv.wait(lock, []{ return !ready.empty() || globals_left == 0; });
+    // Sleepers check their predicate while holding 'ready_mutex',
+    // so taking it here prevents lost wakeups.
+    // If nobody is sleeping, the lock is skipped entirely.
+    if(num_sleeping == 0)
+        return;
 
-    if(globals_left == 0)
-        return nullptr;
-    
-    global_t* ret = ready.back();
-    ready.pop_back();
-    return ret;
+    {
+        std::lock_guard lock(ready_mutex);
+    }
+
+    if(all)
+        ready_cv.notify_all();
+    else
+        ready_cv.notify_one();
+}
+
+global_t* global_t::await_ready_global(std::atomic<bool> const& exception_thrown)
+{
+    while(true)
+    {
+        if(globals_left == 0 || exception_thrown)
+            return nullptr;
+
+        if(global_t* ret = pop_ready(worker_index))
+            return ret;
+
+        // Nothing to do. Sleep until work is shared or everything finishes:
+        std::unique_lock<std::mutex> lock(ready_mutex);
+        ++num_sleeping;
+        ready_cv.wait(lock, [&]{ return ready_count > 0 || globals_left == 0 || exception_thrown; });
+        --num_sleeping;
+    }
 }
 
 void global_t::compile_all()
@@ -1303,12 +1434,22 @@ void fn_t::compile()
     if(iasm)
         return compile_iasm();
 
+    m_compile_start = std::chrono::steady_clock::now();
+
     // Compile the FN.
     ssa_pool::clear();
     cfg_pool::clear();
     ir_t ir;
     build_ir(ir, *this);
 
+    std::unique_ptr<fn_opt_stats_t> opt_stats;
+    if(compiler_options().opt_stats)
+    {
+        opt_stats.reset(new fn_opt_stats_t{ .name = global.name });
+        opt_stats->initial_ssa = ir.ssa_size();
+        opt_stats->initial_cfg = ir.cfg_size();
+    }
+
     auto const save_graph = [&](ir_t& ir, char const* suffix)
     {
         if(!compiler_options().graphviz && !mod_test(mods(), MOD_graphviz))
@@ -1329,7 +1470,38 @@ void fn_t::compile()
 
     auto const optimize_suite = [&](bool post_byteified)
     {
-#define RUN_O(o, ...) do { if(o(__VA_ARGS__)) { \
+        // A pass that changes nothing will keep changing nothing until the IR changes,
+        // as passes only depend on the IR. Such passes get skipped by tracking
+        // which version of the IR each pass last ran on unchanged.
+        unsigned ir_version = 1;
+        std::vector<std::pair<std::string_view, unsigned>> unchanged_versions;
+
+        auto const run_o = [&](char const* name, auto const& fn) -> bool
+        {
+            auto it = std::find_if(unchanged_versions.begin(), unchanged_versions.end(),
+                                   [&](auto const& pair) { return pair.first == name; });
+            if(it == unchanged_versions.end())
+                it = unchanged_versions.insert(it, std::make_pair(std::string_view(name), 0u));
+
+            if(it->second == ir_version)
+            {
+                if(opt_stats)
+                    opt_stats->pass(name).skips += 1;
+                return false;
+            }
+
+            trace_span_t const span(name, "opt");
+            bool const changed = opt_stats ? opt_stats->run(name, ir, fn) : fn();
+
+            if(changed)
+                ++ir_version;
+            else
+                it->second = ir_version;
+
+            return changed;
+        };
+
+#define RUN_O(o, ...) do { if(run_o(#o, [&]{ return o(__VA_ARGS__); })) { \
     changed = true; \
     /*assert((std::printf("DID_O %s %s %i\n", global.name.c_str(), #o, iter), true));*/  } \
     ir.assert_valid(); \
@@ -1386,7 +1558,11 @@ void fn_t::compile()
             {
                 // Once byteified, keep shifts out of the IR and only use rotates.
                 RUN_O(o_shl_tables, log, ir);
-                changed |= shifts_to_rotates(ir, true);
+                if(shifts_to_rotates(ir, true))
+                {
+                    changed = true;
+                    ++ir_version;
+                }
             }
 
             // Enable this to debug:
@@ -1394,9 +1570,20 @@ void fn_t::compile()
             ++iter;
 
             if(iter >= MAX_ITER)
+            {
+                if(opt_stats && changed)
+                    opt_stats->hit_max_iter = true;
+                break;
+            }
+
+            // Leave half of the budget for instruction selection:
+            if(opt_budget_left() < 0.5f)
                 break;
         }
         while(changed);
+
+        if(opt_stats)
+            opt_stats->iterations += iter;
     };
 
     save_graph(ir, "1_initial");
@@ -1415,7 +1602,10 @@ void fn_t::compile()
         optimize_suite(false);
     save_graph(ir, "3_transform");
 
-    byteify(ir, *this);
+    {
+        trace_span_t const span("byteify", "cg");
+        byteify(ir, *this);
+    }
     o_optimize_locators(log, ir);
     save_graph(ir, "4_byteify");
     ir.assert_valid();
@@ -1423,6 +1613,13 @@ void fn_t::compile()
     optimize_suite(true);
     save_graph(ir, "5_o2");
 
+    if(opt_stats)
+    {
+        opt_stats->final_ssa = ir.ssa_size();
+        opt_stats->final_cfg = ir.cfg_size();
+        submit_opt_stats(std::move(*opt_stats));
+    }
+
     std::size_t const proc_size = code_gen(log, ir, *this);
     save_graph(ir, "6_cg");
 
@@ -1472,6 +1669,16 @@ void fn_t::compile()
     }
 }
 
+float fn_t::opt_budget_left() const
+{
+    int const budget = compiler_options().opt_budget_ms;
+    if(budget <= 0)
+        return 1.0f;
+
+    float const elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_compile_start).count();
+    return std::max(0.0f, 1.0f - elapsed / budget);
+}
+
 void fn_t::precheck_finish_mode() const
 {
     assert(fclass == FN_MODE);
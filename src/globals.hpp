@@ -2,6 +2,12 @@
 #define GLOBALS_HPP
 
 #include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <sstream>
 
@@ -31,6 +37,7 @@
 #include "debug_print.hpp"
 #include "byte_block.hpp"
 #include "ident_map.hpp"
+#include "thread.hpp"
 
 class rom_array_t;
 struct precheck_tracked_t;
@@ -79,6 +86,10 @@ private:
     fc::vector_set<global_t*> m_iuses;
     std::atomic<int> m_ideps_left = 0;
 
+    // Used to order the ready list; higher runs first.
+    // This is the estimated cost of the longest chain of 'm_iuses' starting at this global.
+    std::uint64_t m_priority = 0;
+
     // These are for debugging:
 #ifndef NDEBUG
     std::atomic<bool> m_resolved = false;
@@ -228,6 +239,12 @@ private:
     // Updates the ready list.
     global_t* completed();
 
+    // A rough, relative estimate of how long this global takes to process.
+    unsigned estimated_cost() const;
+
+    // Implementation detail used in 'build_order'. Sets 'm_priority'.
+    static std::uint64_t calc_priority(global_t& global);
+
     template<typename Fn>
     void delegate(Fn const& fn)
     {
@@ -243,8 +260,14 @@ private:
         }
     }
 
-    // Returns and pops the next ready global from the ready list.
-    static global_t* await_ready_global();
+    // Returns and pops the next ready global, preferring the highest priority.
+    // Blocks when no work is available.
+    static global_t* await_ready_global(std::atomic<bool> const& exception_thrown);
+
+    // Implementation details of 'await_ready_global':
+    static global_t* pop_ready(unsigned worker_i);
+    static void push_ready(unsigned worker_i, global_t* const* begin, global_t* const* end);
+    static void notify_ready(bool all);
 
 private:
     // Globals get allocated in these:
@@ -266,11 +289,34 @@ private:
     inline static std::mutex chrrom_deque_mutex;
     inline static bc::deque<std::pair<global_t*, ast_node_t const*>> chrrom_deque;
 
-    // These represent a queue of globals ready to be compiled.
+    // Each worker thread owns a heap of globals ready to be compiled, ordered by 'm_priority'.
+    // Workers push onto their own heap, but pop from whichever heap
+    // has the highest priority top, preferring their own.
+    struct alignas(64) ready_heap_t
+    {
+        std::mutex mutex;
+        std::vector<global_t*> heap;
+        std::atomic<std::uint64_t> top_priority = 0; // 0 when empty.
+
+        void push(global_t* global);
+        global_t* pop();
+    };
+
+    // Holds the globals ready before 'do_all' begins, as built by 'build_order'.
+    inline static std::vector<global_t*> ready;
+
+    inline static std::unique_ptr<ready_heap_t[]> ready_heaps;
+    inline static unsigned num_ready_heaps = 0;
+    inline static TLS unsigned worker_index = 0;
+
+    // Sum of all heap sizes. Used to decide when idle workers can sleep.
+    inline static std::atomic<unsigned> ready_count = 0;
+    inline static std::atomic<unsigned> globals_left = 0;
+
+    // Only used to put idle workers to sleep; not taken on the fast path.
+    inline static std::atomic<unsigned> num_sleeping = 0;
     inline static std::condition_variable ready_cv;
     inline static std::mutex ready_mutex;
-    inline static std::vector<global_t*> ready;
-    inline static unsigned globals_left;
 };
 
 class struct_t
@@ -482,6 +528,10 @@ public:
 
     bool sloppy() const { return m_sloppy; }
 
+    // Returns the fraction of the '--opt-budget-ms' budget this function has left,
+    // from 1.0 down to 0.0. Without a budget, this is always 1.0.
+    float opt_budget_left() const;
+
     precheck_tracked_t const& precheck_tracked() const { assert(m_precheck_tracked); return *m_precheck_tracked; }
     auto const& precheck_group_vars() const { assert(m_precheck_group_vars); return m_precheck_group_vars; }
     auto const& precheck_parent_modes() const {assert(compiler_phase() > PHASE_PRECHECK); return m_precheck_parent_modes; }
@@ -496,6 +546,10 @@ public:
     locator_t first_bank_switch() const { assert(global.compiled()); return m_first_bank_switch; }
     void assign_first_bank_switch(locator_t loc) { assert(compiler_phase() == PHASE_COMPILE); m_first_bank_switch = loc; }
 
+    // Estimated runs per mode iteration, relative to other fns. Assigned when allocating RAM.
+    float freq() const { assert(compiler_phase() > PHASE_ALLOC_RAM); return m_freq; }
+    void assign_freq(float freq) { assert(compiler_phase() == PHASE_ALLOC_RAM); m_freq = freq; }
+
     rom_proc_ht rom_proc() const { return m_rom_proc; }
 
     void assign_lvars(lvars_manager_t&& lvars);
@@ -588,12 +642,16 @@ private:
     // If we're using faster, but less accurate code generation:
     bool m_sloppy = false;
 
+    // When 'compile' began, for '--opt-budget-ms':
+    std::chrono::steady_clock::time_point m_compile_start;
+
     // If the function should be inlined:
     bool m_always_inline = false;
 
     // The first, dominating bank switch in this function.
     // (This is the bank the fn should be called from.)
     locator_t m_first_bank_switch = {};
+    float m_freq = 1.0f;
 
     // Holds the assembly code generated.
     rom_proc_ht m_rom_proc;
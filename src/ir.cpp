@@ -73,10 +73,9 @@ void sbo_alloc(T*& ptr, std::uint16_t& size, std::uint16_t& capacity,
 }
 
 // Self-explanatory convenience function..
-template<typename T, std::size_t StorageSize> 
+template<std::size_t StorageSize, typename T> 
 [[gnu::always_inline]] static inline
-void sbo_free(T* ptr, std::uint16_t capacity, 
-              std::array<T, StorageSize>& storage)
+void sbo_free(T* ptr, std::uint16_t capacity)
 {
     if(capacity > StorageSize)
         delete[] ptr;
@@ -100,8 +99,8 @@ void sbo_moved(T*& ptr, std::uint16_t capacity,
 // node_io_buffers_t                  //
 ////////////////////////////////////////
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-auto node_io_buffers_t<I, O, ISize, OSize>::operator=(node_io_buffers_t&& o) 
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+auto node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::operator=(node_io_buffers_t&& o) 
 -> node_io_buffers_t& 
 {
     m_input = o.m_input;
@@ -113,8 +112,13 @@ auto node_io_buffers_t<I, O, ISize, OSize>::operator=(node_io_buffers_t&& o)
     m_input_capacity = o.m_input_capacity;
     m_output_capacity = o.m_output_capacity;
 
-    sbo_moved(m_input, m_input_capacity, m_input_sbo, o.m_input_sbo);
-    sbo_moved(m_output, m_output_capacity, m_output_sbo, o.m_output_sbo);
+    if constexpr(ColdSBO)
+        m_sbo = o.m_sbo; // The cold buffers don't move.
+    else
+    {
+        sbo_moved(m_input, m_input_capacity, sbo().input, o.sbo().input);
+        sbo_moved(m_output, m_output_capacity, sbo().output, o.sbo().output);
+    }
 
     o.m_input_capacity = 0;
     o.m_output_capacity = 0;
@@ -122,72 +126,72 @@ auto node_io_buffers_t<I, O, ISize, OSize>::operator=(node_io_buffers_t&& o)
     return *this;
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-node_io_buffers_t<I, O, ISize, OSize>::~node_io_buffers_t()
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::~node_io_buffers_t()
 {
-    sbo_free(m_input, m_input_capacity, m_input_sbo);
-    sbo_free(m_output, m_output_capacity, m_output_sbo);
+    sbo_free<ISize>(m_input, m_input_capacity);
+    sbo_free<OSize>(m_output, m_output_capacity);
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::alloc_input(unsigned size)
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::alloc_input(unsigned size)
 {
     passert(m_input_capacity == 0, m_input_capacity);
-    sbo_alloc(m_input, m_input_size, m_input_capacity, m_input_sbo, size);
+    sbo_alloc(m_input, m_input_size, m_input_capacity, sbo().input, size);
     assert(input_size() == size);
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::alloc_output(unsigned size)
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::alloc_output(unsigned size)
 {
     passert(m_output_capacity == 0, m_output_capacity);
-    sbo_alloc(m_output, m_output_size, m_output_capacity, m_output_sbo, size);
+    sbo_alloc(m_output, m_output_size, m_output_capacity, sbo().output, size);
     assert(output_size() == size);
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::resize_input(unsigned size)
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::resize_input(unsigned size)
 {
-    sbo_resize(m_input, m_input_size, m_input_capacity, m_input_sbo, size);
+    sbo_resize(m_input, m_input_size, m_input_capacity, sbo().input, size);
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::resize_output(unsigned size)
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::resize_output(unsigned size)
 {
-    sbo_resize(m_output, m_output_size, m_output_capacity, m_output_sbo, size);
+    sbo_resize(m_output, m_output_size, m_output_capacity, sbo().output, size);
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::shrink_input(unsigned size)
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::shrink_input(unsigned size)
 {
     assert(size <= m_input_size);
     m_input_size = size;
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::shrink_output(unsigned size)
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::shrink_output(unsigned size)
 {
     assert(size <= m_output_size);
     m_output_size = size;
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::clear_input()
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::clear_input()
 {
     m_input_size = 0;
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::clear_output()
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::clear_output()
 {
     m_output_size = 0;
 }
 
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
-void node_io_buffers_t<I, O, ISize, OSize>::reset()
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO>
+void node_io_buffers_t<I, O, ISize, OSize, ColdSBO>::reset()
 {
-    sbo_free(m_input, m_input_capacity, m_input_sbo);
-    sbo_free(m_output, m_output_capacity, m_output_sbo);
+    sbo_free<ISize>(m_input, m_input_capacity);
+    sbo_free<OSize>(m_output, m_output_capacity);
     m_input = nullptr;
     m_output = nullptr;
     m_input_size = m_output_size = m_input_capacity = m_output_capacity = 0;
@@ -200,6 +204,7 @@ void node_io_buffers_t<I, O, ISize, OSize>::reset()
 void ssa_node_t::create(cfg_ht cfg_h, ssa_op_t op, type_t type)
 {
     passert(m_io.empty(), input_size(), output_size(), cfg_h, handle(), (int)test_flags(FLAG_PRUNED), output(0));
+    m_io.set_sbo(&ssa_pool::cold(handle()));
     m_cfg_h = cfg_h;
     m_op = op;
     m_type = type;
@@ -1197,6 +1202,6 @@ callable_t const* get_callable(ssa_node_t const& node, bool allow_goto)
     return nullptr;
 }
 
-template class node_io_buffers_t<ssa_fwd_edge_t, ssa_bck_edge_t, 3, 1>;
+template class node_io_buffers_t<ssa_fwd_edge_t, ssa_bck_edge_t, 3, 1, true>;
 template class node_io_buffers_t<cfg_fwd_edge_t, cfg_bck_edge_t, 3, 2>;
 
@@ -32,13 +32,21 @@ inline ssa_node_t* ssa_value_t::operator->() const
 
 // A size-optimized vector-like class that holds both inputs and outputs.
 // It makes use of SBO - small buffer optimization.
-template<typename I, typename O, std::size_t ISize, std::size_t OSize>
+// If 'ColdSBO' is set, the small buffers are stored outside the class,
+// and must be provided using 'set_sbo' before allocating.
+template<typename I, typename O, std::size_t ISize, std::size_t OSize, bool ColdSBO = false>
 class node_io_buffers_t 
 {
 static_assert(std::is_trivially_copyable<I>::value);
 static_assert(std::is_trivially_copyable<O>::value);
 static_assert(std::is_trivially_destructible<I>::value);
 static_assert(std::is_trivially_destructible<O>::value);
+public:
+    struct sbo_t
+    {
+        std::array<I, ISize> input = {};
+        std::array<O, OSize> output = {};
+    };
 private:
     I* m_input = nullptr;
     O* m_output = nullptr;
@@ -49,8 +57,18 @@ private:
     std::uint16_t m_input_capacity = 0;
     std::uint16_t m_output_capacity = 0;
 
-    std::array<I, ISize> m_input_sbo = {};
-    std::array<O, OSize> m_output_sbo = {};
+    std::conditional_t<ColdSBO, sbo_t*, sbo_t> m_sbo = {};
+
+    sbo_t& sbo() 
+    { 
+        if constexpr(ColdSBO)
+        {
+            assert(m_sbo);
+            return *m_sbo;
+        }
+        else
+            return m_sbo; 
+    }
 public:
     node_io_buffers_t() = default;
     node_io_buffers_t(node_io_buffers_t const&) = delete;
@@ -74,6 +92,8 @@ public:
 
     void reset();
 
+    void set_sbo(sbo_t* sbo) requires ColdSBO { m_sbo = sbo; }
+
     std::size_t input_size() const { return m_input_size; }
     std::size_t output_size() const { return m_output_size; }
 
@@ -99,16 +119,20 @@ public:
     O& last_output() { return output(output_size()-1); }
 };
 
-using ssa_buffer_t = node_io_buffers_t<ssa_fwd_edge_t, ssa_bck_edge_t, 3, 1>;
+using ssa_buffer_t = node_io_buffers_t<ssa_fwd_edge_t, ssa_bck_edge_t, 3, 1, true>;
 using cfg_buffer_t = node_io_buffers_t<cfg_fwd_edge_t, cfg_bck_edge_t, 3, 2>;
 
+// The small buffers of 'ssa_node_t', kept in 'ssa_pool's cold storage.
+// This keeps the frequently scanned fields of 'ssa_node_t' in one cache line.
+struct ssa_cold_t : public ssa_buffer_t::sbo_t {};
+
 ////////////////////////////////////////
 // ssa_node_t                         //
 ////////////////////////////////////////
 
 class cfg_node_t;
 
-class alignas(32) ssa_node_t : public intrusive_t<ssa_ht>, public flag_owner_t
+class alignas(64) ssa_node_t : public intrusive_t<ssa_ht>, public flag_owner_t
 {
     friend class ssa_fwd_edge_t;
     friend class ssa_bck_edge_t;
@@ -119,9 +143,9 @@ class alignas(32) ssa_node_t : public intrusive_t<ssa_ht>, public flag_owner_t
     // The following data members have been carefully aligned based on 
     // 64-byte cache lines. Don't mess with it unless you understand it!
 private:
-    type_t m_type = TYPE_VOID;
-    cfg_ht m_cfg_h = {};
     ssa_op_t m_op = SSA_null;
+    cfg_ht m_cfg_h = {};
+    type_t m_type = TYPE_VOID;
     ssa_buffer_t m_io;
 public:
     ssa_node_t() = default;
@@ -202,6 +226,8 @@ private:
     void remove_inputs_output(unsigned i);
 };
 
+static_assert(sizeof(ssa_node_t) == 64, "ssa_node_t should fit in a single cache line.");
+
 ////////////////////////////////////////
 // cfg_node_t                         //
 ////////////////////////////////////////
@@ -0,0 +1,99 @@
+#include "isel_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+#include "format.hpp"
+
+namespace
+{
+    std::mutex stats_mutex;
+    std::vector<fn_isel_stats_t> all_stats;
+
+    double to_ms(std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+    void print_fn_header(std::ostream& o)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "    %-32s %6s %8s %10s %10s %10s %10s %10s\n",
+                      "fn", "cfgs", "visits", "cutoff", "beam", "truncated", "ms", "pbqp ms");
+        o << buf;
+    }
+
+    void print_cfg_header(std::ostream& o)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "    %6s %6s %6s %6s %6s %10s %10s %6s %9s %10s %10s\n",
+                      "cfg", "ssa", "visits", "width", "peak", "cutoff", "beam", "sels", "truncated", "ms", "cost");
+        o << buf;
+    }
+
+    void print_cfg(std::ostream& o, cfg_isel_stats_t const& c)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "    %6u %6u %6u %6u %6u %10llu %10llu %6u %9u %10.3f %10llu\n",
+                      c.cfg_id, c.ssa_size, c.visits, c.max_beam, c.peak_map,
+                      (unsigned long long)c.cutoff_prunes, (unsigned long long)c.beam_prunes,
+                      c.sels, c.truncated, to_ms(c.time), (unsigned long long)c.final_cost);
+        o << buf;
+    }
+}
+
+void submit_isel_stats(fn_isel_stats_t&& stats)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    all_stats.push_back(std::move(stats));
+}
+
+void print_isel_stats(std::ostream& o)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+
+    // Sort for a deterministic output:
+    std::sort(all_stats.begin(), all_stats.end(), [](auto const& a, auto const& b) { return a.name < b.name; });
+
+    std::vector<fn_isel_stats_t const*> by_time;
+    for(fn_isel_stats_t const& fn : all_stats)
+        by_time.push_back(&fn);
+    std::sort(by_time.begin(), by_time.end(), [](auto const* a, auto const* b) { return a->time > b->time; });
+
+    o << fmt("Instruction selection stats of % functions.\n", all_stats.size());
+    o << "Selections are pruned by 'cost_cutoff' (cutoff), by the search width (beam),\n"
+         "and after the search by 'shrink_sels' (truncated).\n\n";
+
+    o << "ALL FUNCTIONS\n";
+    print_fn_header(o);
+    for(fn_isel_stats_t const* fn : by_time)
+    {
+        cfg_isel_stats_t total = {};
+        for(cfg_isel_stats_t const& c : fn->cfgs)
+        {
+            total.visits += c.visits;
+            total.cutoff_prunes += c.cutoff_prunes;
+            total.beam_prunes += c.beam_prunes;
+            total.truncated += c.truncated;
+        }
+
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "    %-32s %6u %8u %10llu %10llu %10u %10.3f %10.3f\n",
+                      fn->name.c_str(), unsigned(fn->cfgs.size()), total.visits,
+                      (unsigned long long)total.cutoff_prunes, (unsigned long long)total.beam_prunes,
+                      total.truncated, to_ms(fn->time), to_ms(fn->pbqp_time));
+        o << buf;
+    }
+
+    for(fn_isel_stats_t const& fn : all_stats)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "\nFN %s (ms: %.3f, pbqp ms: %.3f)\n",
+                      fn.name.c_str(), to_ms(fn.time), to_ms(fn.pbqp_time));
+        o << buf;
+        print_cfg_header(o);
+        for(cfg_isel_stats_t const& c : fn.cfgs)
+            print_cfg(o, c);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef ISEL_STATS_HPP
+#define ISEL_STATS_HPP
+
+// Statistics about instruction selection, output by '--isel-stats'.
+// Used to find where the search limits discard better code,
+// and where the search spends its time.
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "pbqp.hpp"
+
+// The stats of a single CFG node.
+struct cfg_isel_stats_t
+{
+    unsigned cfg_id = 0;
+    unsigned ssa_size = 0;
+    unsigned visits = 0;   // Times the worklist searched the node.
+    unsigned max_beam = 0; // Largest 'max_map_size' used.
+    unsigned peak_map = 0; // Largest number of in-flight selections.
+
+    // Summed over every visit:
+    std::uint64_t cutoff_prunes = 0; // Selections dropped by 'cost_cutoff'.
+    std::uint64_t beam_prunes = 0;   // Selections dropped by 'max_map_size'.
+
+    unsigned sels = 0;      // Selections kept for PBQP.
+    unsigned truncated = 0; // Selections dropped by 'shrink_sels'.
+
+    std::chrono::steady_clock::duration time = {};
+    pbqp_cost_t final_cost = 0;
+};
+
+// The stats of a single function.
+struct fn_isel_stats_t
+{
+    std::string name;
+    std::chrono::steady_clock::duration time = {};
+    std::chrono::steady_clock::duration pbqp_time = {};
+    std::vector<cfg_isel_stats_t> cfgs;
+};
+
+// Adds a function's stats to the total. Thread-safe.
+void submit_isel_stats(fn_isel_stats_t&& stats);
+
+// Writes a summary of every function, followed by the stats of each CFG node.
+void print_isel_stats(std::ostream& o);
+
+#endif
@@ -1,11 +1,14 @@
 // This project is licensed under the Boost Software License.
 // See license.txt for details.
 
+#include <charconv>
 #include <cstdlib>
 #include <chrono>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <iterator>
+#include <sstream>
 
 #include <boost/program_options.hpp>
 
@@ -29,6 +32,15 @@
 #include "macro.hpp"
 #include "guard.hpp"
 #include "ctags.hpp"
+#include "build_cache.hpp"
+#include "trace.hpp"
+#include "opt_stats.hpp"
+#include "isel_stats.hpp"
+#include "platform.hpp"
+
+#ifdef PLATFORM_UNIX
+#  include <unistd.h>
+#endif
 
 extern char __GIT_COMMIT;
 
@@ -84,12 +96,16 @@ void handle_options(fs::path dir, po::options_description const& cfg_desc, po::v
             else if(ext == ".cfg")
             {
                 fs::path const full_path = dir / path;
-                std::ifstream ifs(full_path.string(), std::ios::in);
-                if(ifs)
+                std::ifstream file(full_path.string(), std::ios::in);
+                if(file)
                 {
                     fs::path cfg_dir = full_path;
                     cfg_dir.remove_filename();
 
+                    std::string const contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                    build_cache_record_read(full_path, contents.data(), contents.size());
+                    std::istringstream ifs(contents);
+
                     po::variables_map cfg_vm;
                     po::store(po::parse_config_file(ifs, cfg_desc), cfg_vm);
                     po::notify(cfg_vm);
@@ -129,6 +145,12 @@ void handle_options(fs::path dir, po::options_description const& cfg_desc, po::v
     if(vm.count("ctags"))
         _options.raw_ctags = (dir / fs::path(vm["ctags"].as<std::string>())).string();
 
+    if(vm.count("cache-dir"))
+        _options.raw_cache_dir = (dir / fs::path(vm["cache-dir"].as<std::string>())).string();
+
+    if(vm.count("trace"))
+        _options.raw_trace = (dir / fs::path(vm["trace"].as<std::string>())).string();
+
     if(vm.count("graphviz"))
         _options.graphviz = true;
 
@@ -234,12 +256,65 @@ void handle_options(fs::path dir, po::options_description const& cfg_desc, po::v
     if(vm.count("info") || vm.count("rom-info"))
         _options.rom_info = true;
 
+    if(vm.count("info") || vm.count("opt-stats"))
+        _options.opt_stats = true;
+
+    if(vm.count("info") || vm.count("isel-stats"))
+        _options.isel_stats = true;
+
     if(vm.count("pause"))
         _options.pause = true;
 
+    if(vm.count("watch"))
+    {
+#ifdef PLATFORM_UNIX
+        _options.watch = true;
+#else
+        compiler_warning("Watch mode is not supported on this platform.");
+#endif
+    }
+
     if(vm.count("sloppy"))
         _options.sloppy = true;
 
+    if(vm.count("opt-budget-ms"))
+        _options.opt_budget_ms = std::max(vm["opt-budget-ms"].as<int>(), 0);
+
+    if(vm.count("isel-beam"))
+    {
+        std::string str = to_lower(vm["isel-beam"].as<std::string>());
+
+        if(str == "adaptive")
+            _options.isel_adaptive = true;
+        else
+        {
+            char const* const end = str.data() + str.size();
+            auto const result = std::from_chars(str.data(), end, _options.isel_beam);
+            if(result.ec != std::errc() || result.ptr != end || _options.isel_beam == 0)
+                throw std::runtime_error(fmt("Unknown isel-beam: %", str));
+        }
+    }
+
+    if(vm.count("ram-alloc"))
+    {
+        std::string str = to_lower(vm["ram-alloc"].as<std::string>());
+
+        if(str == "graph")
+            _options.ram_alloc_graph = true;
+        else if(str != "greedy")
+            throw std::runtime_error(fmt("Unknown ram-alloc: %", str));
+    }
+
+    if(vm.count("rom-alloc"))
+    {
+        std::string str = to_lower(vm["rom-alloc"].as<std::string>());
+
+        if(str == "search")
+            _options.rom_alloc_search = true;
+        else if(str != "greedy")
+            throw std::runtime_error(fmt("Unknown rom-alloc: %", str));
+    }
+
     if(vm.count("unsafe-bank-switch"))
         _options.unsafe_bank_switch = true;
 
@@ -266,10 +341,60 @@ void handle_options(fs::path dir, po::options_description const& cfg_desc, po::v
         _options.vram_init = true;
 }
 
+// Waits until an input file changes, then restarts the compiler with the same arguments.
+[[noreturn]] void rebuild_on_change(char** argv)
+{
+    std::printf("Watching for changes...\n");
+    std::fflush(stdout);
+    std::fflush(stderr);
+
+    build_cache_await_change();
+
+#ifdef PLATFORM_UNIX
+    execv("/proc/self/exe", argv);
+    execvp(argv[0], argv);
+#endif
+    std::fprintf(stderr, "Unable to restart the compiler.\n");
+    std::exit(EXIT_FAILURE);
+}
+
 int main(int argc, char** argv)
 {
     auto entry_time = std::chrono::system_clock::now();
 
+    auto const finish = [&]() -> int
+    {
+        if(compiler_options().build_time)
+        {
+            auto now = std::chrono::system_clock::now();
+            unsigned long long const ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry_time).count();
+            std::printf("time total:     %8lli ms\n", ms);
+        }
+
+        trace_write();
+
+        if(compiler_options().watch)
+            rebuild_on_change(argv);
+
+        if(compiler_options().pause)
+            std::fgetc(stdin);
+
+        return EXIT_SUCCESS;
+    };
+
+    auto const write_output = [](std::vector<std::uint8_t> const& rom)
+    {
+        FILE* of = std::fopen(compiler_options().output_file.c_str(), "wb");
+        if(!of)
+            throw std::runtime_error(fmt("Unable to open file %", compiler_options().output_file));
+        if(!std::fwrite(rom.data(), rom.size(), 1, of))
+        {
+            std::fclose(of);
+            throw std::runtime_error(fmt("Unable to write to file %", compiler_options().output_file));
+        }
+        std::fclose(of);
+    };
+
 #ifdef NDEBUG
     try
 #endif
@@ -298,7 +423,10 @@ int main(int argc, char** argv)
                 ("threads,j", po::value<int>(), "number of compiler threads")
                 ("error-on-warning,W", "turn warnings into errors")
                 ("pause", "await input on stdin before exiting")
+                ("watch", "rebuild whenever an input file changes")
                 ("sloppy", "faster compile times, but worse optimization")
+                ("opt-budget-ms", po::value<int>(), "time limit for optimizing each function (in ms, 0 is off)")
+                ("isel-beam", po::value<std::string>(), "search width of instruction selection, or 'adaptive'")
             ;
 
             po::options_description mapper_opt("Mapper options");
@@ -318,8 +446,12 @@ int main(int argc, char** argv)
                 ("system,S", po::value<std::string>(), "target NES system")
                 ("controllers,C", po::value<int>(), "maximum number of controllers used")
                 ("unsafe-bank-switch", "faster but less safe bank switches")
+                ("ram-alloc", po::value<std::string>(), "local variable RAM allocator ('greedy' or 'graph')")
+                ("rom-alloc", po::value<std::string>(), "ROM bank packing ('greedy' or 'search')")
                 ("mlb", po::value<std::string>(), "generate Mesen label file")
                 ("ctags", po::value<std::string>(), "generate Ctags file")
+                ("cache-dir", po::value<std::string>(), "reuse output of unchanged builds")
+                ("trace", po::value<std::string>(), "generate Chrome trace of compiler work")
             ;
 
             po::options_description basic_hidden("Hidden options");
@@ -330,6 +462,8 @@ int main(int argc, char** argv)
                 ("ir-info", "output intermediate info")
                 ("ram-info", "output RAM info")
                 ("rom-info", "output ROM info")
+                ("opt-stats", "output optimizer statistics")
+                ("isel-stats", "output instruction selection statistics")
                 ("time-limit,T", po::value<int>(), "interpreter execution time limit (in ms, 0 is off)")
                 ("build-time,B", "print compiler execution time")
                 ("fast-debug", "faster debugging")
@@ -498,10 +632,25 @@ int main(int argc, char** argv)
         // OK! Now to do the actual work: //
         ////////////////////////////////////
 
+        // Threads are created once here and reused by every parallel phase:
+        thread_pool_t thread_pool(compiler_options().num_threads);
+
+        if(!compiler_options().raw_trace.empty())
+            trace_init(compiler_options().raw_trace);
+
         auto time = std::chrono::system_clock::now();
+        auto trace_time = trace_clock_t::now();
 
-        auto const output_time = [&time](char const* desc)
+        auto const output_time = [&time, &trace_time](char const* desc)
         {
+            if(trace_enabled())
+            {
+                std::string_view name = desc;
+                name = name.substr(0, name.find(':'));
+                trace_record("phase", "phase", trace_time, std::string(name));
+                trace_time = trace_clock_t::now();
+            }
+
             if(compiler_options().build_time)
             {
                 auto now = std::chrono::system_clock::now();
@@ -511,6 +660,24 @@ int main(int argc, char** argv)
             }
         };
 
+        // The cache can't reproduce extra outputs, so only use it for plain builds:
+        if(!compiler_options().raw_cache_dir.empty()
+           && compiler_options().raw_mlb.empty() && compiler_options().raw_ctags.empty()
+           && !compiler_options().graphviz && !compiler_options().ir_info
+           && !compiler_options().ram_info && !compiler_options().rom_info
+           && !compiler_options().opt_stats && !compiler_options().isel_stats)
+        {
+            build_cache_init(compiler_options().raw_cache_dir, argc, argv);
+
+            std::vector<std::uint8_t> rom;
+            if(build_cache_lookup(rom))
+            {
+                write_output(rom);
+                output_time("cached:   ");
+                return finish();
+            }
+        }
+
         global_t::init();
 
         std::ofstream mlb_out;
@@ -615,6 +782,24 @@ int main(int argc, char** argv)
         global_t::compile_all();
         output_time("compile:  ");
 
+        if(compiler_options().opt_stats)
+        {
+            std::filesystem::create_directory("info/");
+
+            std::ofstream of(fmt("info/opt_stats.txt"));
+            if(of.is_open())
+                print_opt_stats(of);
+        }
+
+        if(compiler_options().isel_stats)
+        {
+            std::filesystem::create_directory("info/");
+
+            std::ofstream of(fmt("info/isel_stats.txt"));
+            if(of.is_open())
+                print_isel_stats(of);
+        }
+
         auto write_info = make_scope_guard([&]() {
             for(fn_t const& fn : fn_ht::values())
             {
@@ -664,7 +849,7 @@ int main(int argc, char** argv)
         link_variables_optimize();
         //set_compiler_phase(PHASE_ALLOC_ROM);
         alloc_rom(nullptr, rom_allocator);
-        if(compiler_options().ram_info)
+        if(compiler_options().rom_info)
         {
             std::filesystem::create_directory("info/");
 
@@ -676,15 +861,8 @@ int main(int argc, char** argv)
 
         set_compiler_phase(PHASE_LINK);
         auto rom = write_rom();
-        FILE* of = std::fopen(compiler_options().output_file.c_str(), "wb");
-        if(!of)
-            throw std::runtime_error(fmt("Unable to open file %", compiler_options().output_file));
-        if(!std::fwrite(rom.data(), rom.size(), 1, of))
-        {
-            std::fclose(of);
-            throw std::runtime_error(fmt("Unable to write to file %", compiler_options().output_file));
-        }
-        std::fclose(of);
+        write_output(rom);
+        build_cache_store(rom);
         output_time("link:     ");
 
         if(mlb_out)
@@ -701,6 +879,11 @@ int main(int argc, char** argv)
     {
         std::fprintf(stderr, "%s\n", e.what());
 
+        trace_write();
+
+        if(compiler_options().watch)
+            rebuild_on_change(argv);
+
         if(compiler_options().pause)
             std::fgetc(stdin);
 
@@ -708,16 +891,6 @@ int main(int argc, char** argv)
     }
 #endif
 
-    if(compiler_options().build_time)
-    {
-        auto now = std::chrono::system_clock::now();
-        unsigned long long const ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry_time).count();
-        std::printf("time total:     %8lli ms\n", ms);
-    }
-
-    if(compiler_options().pause)
-        std::fgetc(stdin);
-
-    return EXIT_SUCCESS;
+    return finish();
 }
 
@@ -842,9 +842,12 @@ void ai_t::compute_constraints(executable_index_t exec_i, ssa_ht ssa_node)
         }
 
         // Build an array holding all the argument's constraints.
+        // This is kept between visits (and runs) to reuse its storage,
+        // as nodes get visited many times.
         unsigned const input_size = ssa_node->input_size();
-        bc::small_vector<constraints_def_t, 16> c;
-        c.resize(input_size);
+        static TLS bc::small_vector<constraints_def_t, 16> c;
+        if(c.size() < input_size)
+            c.resize(input_size);
         if(ssa_node->op() == SSA_phi)
         {
             // For phi nodes, if an input CFG edge hasn't been marked
@@ -863,7 +866,10 @@ void ai_t::compute_constraints(executable_index_t exec_i, ssa_ht ssa_node)
                     dprint(log, "-COMPUTE_CONSTRAINTS_PHI", ssa_node, i, ssa_node->input(i), c[i].vec.size());
                 }
                 else
+                {
+                    c[i].cm = {};
                     c[i].vec.assign(d.constraints().vec.size(), constraints_t::top());
+                }
             }
         }
         else for(unsigned i = 0; i < input_size; ++i)
@@ -879,9 +885,9 @@ void ai_t::compute_constraints(executable_index_t exec_i, ssa_ht ssa_node)
         d.executable_index = exec_i;
         dprint(log, "-COMPUTE_CONSTRAINTS", ssa_node, ssa_node->op());
 #ifndef NDEBUG
-        for(auto const& c : c)
-            if(c.vec.size())
-                dprint(log, "--I", c.vec[0]);
+        for(unsigned i = 0; i < input_size; ++i)
+            if(c[i].vec.size())
+                dprint(log, "--I", c[i].vec[0]);
 #endif
         abstract_fn(ssa_node->op())(c.data(), input_size, d.constraints());
     }
@@ -0,0 +1,100 @@
+#include "opt_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include "format.hpp"
+
+namespace
+{
+    std::mutex stats_mutex;
+    std::vector<fn_opt_stats_t> all_stats;
+
+    double to_ms(std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+    void print_header(std::ostream& o)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "    %-28s %8s %8s %8s %10s %10s %10s %8s %8s\n",
+                      "pass", "runs", "changes", "skips", "ms", "ssa in", "ssa out", "cfg in", "cfg out");
+        o << buf;
+    }
+
+    void print_pass(std::ostream& o, opt_pass_stats_t const& p)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "    %-28s %8u %8u %8u %10.3f %10llu %10llu %8llu %8llu\n",
+                      p.name, p.runs, p.changes, p.skips, to_ms(p.time),
+                      (unsigned long long)p.ssa_before, (unsigned long long)p.ssa_after,
+                      (unsigned long long)p.cfg_before, (unsigned long long)p.cfg_after);
+        o << buf;
+    }
+}
+
+opt_pass_stats_t& fn_opt_stats_t::pass(char const* name)
+{
+    for(opt_pass_stats_t& p : passes)
+        if(std::strcmp(p.name, name) == 0)
+            return p;
+    return passes.emplace_back(opt_pass_stats_t{ .name = name });
+}
+
+void submit_opt_stats(fn_opt_stats_t&& stats)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    all_stats.push_back(std::move(stats));
+}
+
+void print_opt_stats(std::ostream& o)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+
+    // Sort for a deterministic output:
+    std::sort(all_stats.begin(), all_stats.end(), [](auto const& a, auto const& b) { return a.name < b.name; });
+
+    fn_opt_stats_t total;
+    for(fn_opt_stats_t const& fn : all_stats)
+    {
+        for(opt_pass_stats_t const& p : fn.passes)
+        {
+            opt_pass_stats_t& t = total.pass(p.name);
+            t.runs += p.runs;
+            t.changes += p.changes;
+            t.skips += p.skips;
+            t.time += p.time;
+            t.ssa_before += p.ssa_before;
+            t.ssa_after += p.ssa_after;
+            t.cfg_before += p.cfg_before;
+            t.cfg_after += p.cfg_after;
+        }
+    }
+
+    std::sort(total.passes.begin(), total.passes.end(), [](auto const& a, auto const& b) { return a.time > b.time; });
+
+    o << fmt("Optimizer stats of % functions.\n\n", all_stats.size());
+
+    o << "ALL FUNCTIONS\n";
+    print_header(o);
+    for(opt_pass_stats_t const& p : total.passes)
+        print_pass(o, p);
+
+    o << "\nHIT MAX ITERATIONS\n";
+    for(fn_opt_stats_t const& fn : all_stats)
+        if(fn.hit_max_iter)
+            o << fmt("    %\n", fn.name);
+
+    for(fn_opt_stats_t const& fn : all_stats)
+    {
+        o << fmt("\nFN % (iterations: %, ssa: % -> %, cfg: % -> %)%\n",
+                 fn.name, fn.iterations, fn.initial_ssa, fn.final_ssa, fn.initial_cfg, fn.final_cfg,
+                 fn.hit_max_iter ? " HIT MAX ITERATIONS" : "");
+        print_header(o);
+        for(opt_pass_stats_t const& p : fn.passes)
+            print_pass(o, p);
+    }
+}
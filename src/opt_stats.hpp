@@ -0,0 +1,70 @@
+#ifndef OPT_STATS_HPP
+#define OPT_STATS_HPP
+
+// Statistics about the optimizer, output by '--opt-stats'.
+// Used to judge which optimization passes are worth their compile time.
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ir.hpp"
+
+struct opt_pass_stats_t
+{
+    char const* name;
+    unsigned runs = 0;
+    unsigned changes = 0;
+    unsigned skips = 0; // Runs skipped, as the IR hadn't changed.
+    std::chrono::steady_clock::duration time = {};
+
+    // Summed over every run:
+    std::uint64_t ssa_before = 0;
+    std::uint64_t ssa_after = 0;
+    std::uint64_t cfg_before = 0;
+    std::uint64_t cfg_after = 0;
+};
+
+// The stats of a single function.
+struct fn_opt_stats_t
+{
+    std::string name;
+    unsigned iterations = 0;
+    bool hit_max_iter = false;
+    std::size_t initial_ssa = 0;
+    std::size_t initial_cfg = 0;
+    std::size_t final_ssa = 0;
+    std::size_t final_cfg = 0;
+    std::vector<opt_pass_stats_t> passes; // In the order they first ran.
+
+    opt_pass_stats_t& pass(char const* name);
+
+    // Runs a pass returning true if it changed the IR, recording it.
+    template<typename Fn>
+    bool run(char const* name, ir_t const& ir, Fn const& fn)
+    {
+        opt_pass_stats_t& p = pass(name);
+        p.ssa_before += ir.ssa_size();
+        p.cfg_before += ir.cfg_size();
+
+        auto const start = std::chrono::steady_clock::now();
+        bool const changed = fn();
+        p.time += std::chrono::steady_clock::now() - start;
+
+        p.ssa_after += ir.ssa_size();
+        p.cfg_after += ir.cfg_size();
+        p.runs += 1;
+        p.changes += changed;
+        return changed;
+    }
+};
+
+// Adds a function's stats to the total. Thread-safe.
+void submit_opt_stats(fn_opt_stats_t&& stats);
+
+// Writes a summary of every pass, followed by the stats of each function.
+void print_opt_stats(std::ostream& o);
+
+#endif
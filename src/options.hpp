@@ -24,16 +24,24 @@ struct options_t
 {
     int num_threads = 1;
     int time_limit = 1000;
+    int opt_budget_ms = 0; // Per function. 0 means no limit.
+    unsigned isel_beam = 0; // 0 means the default width.
+    bool isel_adaptive = false;
     bool graphviz = false;
     bool ir_info = false;
     bool ram_info = false;
     bool rom_info = false;
+    bool opt_stats = false;
+    bool isel_stats = false;
     bool build_time = false;
     bool werror = false;
     bool pause = false;
+    bool watch = false;
     bool unsafe_bank_switch = false;
     bool assert_valid = true;
     bool sloppy = false;
+    bool ram_alloc_graph = false;
+    bool rom_alloc_search = false;
     bool action53 = false;
 
     bool ram_init = false;
@@ -52,6 +60,12 @@ struct options_t
     std::string raw_mlb;
     std::string raw_ctags;
 
+    // Directory of the build cache, if any:
+    std::string raw_cache_dir;
+
+    // Chrome trace output file, if any:
+    std::string raw_trace;
+
     nes_system_t nes_system = NES_SYSTEM_UNKNOWN;
     std::string raw_system;
 
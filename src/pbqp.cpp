@@ -11,26 +11,57 @@ void handle_cases(bool node_a, Fn const& fn)
         fn(false);
 }
 
-template<typename Fn> [[gnu::flatten]]
-void handle_cases(bool node_a, bool node_b, Fn const& fn)
+// Returns the first 'i' minimizing 'a[i] + b[i]', storing the minimum in 'min'.
+// The minimum is found first, as that loop vectorizes.
+[[gnu::always_inline]]
+static unsigned min_sum(pbqp_cost_t const* a, pbqp_cost_t const* b, unsigned size, pbqp_cost_t& min)
 {
-    if(node_a)
-    {
-        if(node_b)
-            fn(true, true);
-        else
-            fn(true, false);
-    }
-    else
+    assert(size > 0);
+
+    pbqp_cost_t m = ~0ull;
+    for(unsigned i = 0; i < size; ++i)
+        m = std::min<pbqp_cost_t>(m, a[i] + b[i]);
+    min = m;
+
+    for(unsigned i = 0;; ++i)
+        if(a[i] + b[i] == m)
+            return i;
+}
+
+// Returns the cost matrix of 'edge' laid out with the selections of
+// node 'node_i' contiguous, transposing it into 'scratch' if needed.
+static pbqp_cost_t const* node_major(pbqp_edge_t& edge, bool node_i, std::vector<pbqp_cost_t>& scratch)
+{
+    if(node_i == pbqp_edge_t::FROM)
+        return edge.cost_matrix;
+
+    unsigned const n = edge.nodes[pbqp_edge_t::TO]->num_sels();
+    unsigned const m = edge.nodes[pbqp_edge_t::FROM]->num_sels();
+    scratch.resize(n * m);
+
+    for(unsigned i = 0; i < n; ++i)
+    for(unsigned j = 0; j < m; ++j)
+        scratch[i + j * n] = edge.cost(i, j, node_i);
+
+    return scratch.data();
+}
+
+pbqp_cost_t* pbqp_t::new_matrix(std::size_t size)
+{
+    if(size > arena_left)
     {
-        if(node_b)
-            fn(false, true);
-        else
-            fn(false, false);
+        std::size_t const chunk_size = std::max<std::size_t>(size, 1 << 14);
+        arena_next = arena.emplace_back(new pbqp_cost_t[chunk_size]()).get();
+        arena_left = chunk_size;
     }
+
+    pbqp_cost_t* const ret = arena_next;
+    arena_next += size;
+    arena_left -= size;
+    return ret;
 }
 
-void pbqp_t::solve(std::vector<pbqp_node_t*> order)
+void pbqp_t::solve(std::vector<pbqp_node_t*> order, unsigned refine_passes)
 {
     if(order.empty())
         return;
@@ -40,6 +71,20 @@ void pbqp_t::solve(std::vector<pbqp_node_t*> order)
         assert(node->num_sels() > 0);
 #endif
 
+    std::vector<original_node_t> original;
+    if(refine_passes)
+    {
+        original.reserve(order.size());
+        for(pbqp_node_t* node : order)
+        {
+            auto& o = original.emplace_back(original_node_t{ node, node->cost_vector });
+            for(unsigned i = 0; i < node->degree; ++i)
+                o.edges.push_back(*node->edges[i]);
+        }
+    }
+
+    solving = true;
+
     std::vector<pbqp_node_t*> next_order;
     next_order.reserve(order.size());
 
@@ -118,12 +163,60 @@ void pbqp_t::solve(std::vector<pbqp_node_t*> order)
             node.sel = node.bp_proof[index];
         }
     }
+
+    // Without heuristic reductions, the solution is already optimal.
+    if(heuristic_reductions)
+        refine(original, refine_passes);
 }
 
-void pbqp_t::add_edge(pbqp_node_t& from, pbqp_node_t& to, std::vector<pbqp_cost_t> cost_matrix)
+void pbqp_t::refine(std::vector<original_node_t> const& original, unsigned passes)
+{
+    for(unsigned pass = 0; pass < passes; ++pass)
+    {
+        bool improved = false;
+
+        for(original_node_t const& o : original)
+        {
+            pbqp_node_t& node = *o.node;
+
+            auto const sel_cost = [&](unsigned i) -> pbqp_cost_t
+            {
+                pbqp_cost_t cost = o.cost_vector[i];
+                for(pbqp_edge_t edge : o.edges)
+                {
+                    bool const node_i = edge.index(node);
+                    cost += edge.cost(i, edge.nodes[!node_i]->sel, node_i);
+                }
+                return cost;
+            };
+
+            // Each change strictly lowers the total cost, so this can't cycle.
+            pbqp_cost_t best_cost = sel_cost(node.sel);
+            for(unsigned i = 0; i < node.num_sels(); ++i)
+            {
+                if(int(i) == node.sel)
+                    continue;
+
+                pbqp_cost_t const cost = sel_cost(i);
+                if(cost < best_cost)
+                {
+                    dprint(log, "-PBQP REFINE", &node, node.sel, i, best_cost, cost);
+                    best_cost = cost;
+                    node.sel = i;
+                    improved = true;
+                }
+            }
+        }
+
+        if(!improved)
+            break;
+    }
+}
+
+void pbqp_t::add_edge(pbqp_node_t& from, pbqp_node_t& to, pbqp_cost_t* cost_matrix)
 {
     assert(from.degree >= 0 && to.degree >= 0);
-    assert(cost_matrix.size() == from.num_sels() * to.num_sels());
+    unsigned const matrix_size = from.num_sels() * to.num_sels();
 
     // Handle loops:
     if(&from == &to)
@@ -136,19 +229,28 @@ void pbqp_t::add_edge(pbqp_node_t& from, pbqp_node_t& to, std::vector<pbqp_cost_
     // Handle duplicate edges:
     for(int i = 0; i < from.degree; ++i)
     {
-        auto& prev_matrix = from.edges[i]->cost_matrix;
+        bool const eq = from.edges[i]->eq(from, to);
+        if(!eq && !from.edges[i]->eq_flipped(from, to))
+            continue;
+
+        pbqp_cost_t*& prev_matrix = from.edges[i]->cost_matrix;
+
+        // Leave the original matrix intact for 'refine':
+        if(solving)
+        {
+            pbqp_cost_t* const copy = new_matrix(matrix_size);
+            std::copy_n(prev_matrix, matrix_size, copy);
+            prev_matrix = copy;
+        }
 
-        if(from.edges[i]->eq(from, to))
+        if(eq)
         {
-            assert(prev_matrix.size() == cost_matrix.size());
-            for(unsigned j = 0; j < cost_matrix.size(); ++j)
+            for(unsigned j = 0; j < matrix_size; ++j)
                 prev_matrix[j] += cost_matrix[j];
             return;
         }
-        else if(from.edges[i]->eq_flipped(from, to))
+        else
         {
-            assert(prev_matrix.size() == cost_matrix.size());
-
             // Transpose the cost matrix while adding:
             for(unsigned x = 0; x < from.num_sels(); ++x)
             for(unsigned y = 0; y < to.num_sels(); ++y)
@@ -158,7 +260,7 @@ void pbqp_t::add_edge(pbqp_node_t& from, pbqp_node_t& to, std::vector<pbqp_cost_
     }
 
     // Otherwise, create the edge:
-    auto& edge = edge_pool.emplace_back(pbqp_edge_t{ { &from, &to }, std::move(cost_matrix) });
+    auto& edge = edge_pool.emplace_back(pbqp_edge_t{ { &from, &to }, cost_matrix });
 
     from.edges.push_back(&edge);
     std::swap(from.edges.back(), from.edges[from.degree++]);
@@ -193,29 +295,15 @@ bool pbqp_t::optimal_reduction(pbqp_node_t& node)
 
         node.bp_proof.resize(other.num_sels());
 
-        handle_cases(node_i, [&](bool node_i) __attribute__((always_inline))
-        {
-            for(unsigned j = 0; j < other.num_sels(); ++j)
-            {
-                pbqp_cost_t min_cost = ~0ull;
-                auto& bp_proof = node.bp_proof[j];
-
-                for(unsigned i = 0; i < node.num_sels(); ++i)
-                {
-                    pbqp_cost_t const cost = (edge->cost(i, j, node_i)
-                        + node.cost_vector[i] 
-                        + other.cost_vector[j]);
+        unsigned const n = node.num_sels();
+        pbqp_cost_t const* const matrix = node_major(*edge, node_i, scratch_a);
 
-                    if(cost < min_cost)
-                    {
-                        min_cost = cost;
-                        bp_proof = i;
-                    }
-                }
-
-                other.cost_vector[j] = min_cost;
-            }
-        });
+        for(unsigned j = 0; j < other.num_sels(); ++j)
+        {
+            pbqp_cost_t min_cost;
+            node.bp_proof[j] = min_sum(node.cost_vector.data(), matrix + j * n, n, min_cost);
+            other.cost_vector[j] += min_cost;
+        }
 
         bp_stack.push_back(&node);
         other.dec_degree(edge);
@@ -240,38 +328,29 @@ bool pbqp_t::optimal_reduction(pbqp_node_t& node)
 
         unsigned const matrix_size = other_a.num_sels() * other_b.num_sels();
         node.bp_proof.resize(matrix_size);
-        std::vector<pbqp_cost_t> new_matrix(matrix_size);
+        pbqp_cost_t* const new_matrix = this->new_matrix(matrix_size);
 
-        handle_cases(node_a, node_b, [&](bool node_a, bool node_b) __attribute__((always_inline))
+        unsigned const n = node.num_sels();
+        pbqp_cost_t const* const matrix_a = node_major(*edge_a, node_a, scratch_a);
+        pbqp_cost_t const* const matrix_b = node_major(*edge_b, node_b, scratch_b);
+        row.resize(n);
+
+        for(unsigned a = 0 ; a < other_a.num_sels(); ++a)
         {
-            for(unsigned a = 0 ; a < other_a.num_sels(); ++a)
+            for(unsigned i = 0; i < n; ++i)
+                row[i] = node.cost_vector[i] + matrix_a[i + a * n];
+
             for(unsigned b = 0 ; b < other_b.num_sels(); ++b)
             {
-                pbqp_cost_t min_cost = ~0ull;
-                auto& bp_proof = node.bp_proof[a + (other_a.num_sels() * b)];
-
-                for(unsigned i = 0; i < node.num_sels(); ++i)
-                {
-                    pbqp_cost_t const cost = (node.cost_vector[i] 
-                        + edge_a->cost(i, a, node_a) 
-                        + edge_b->cost(i, b, node_b));
-
-                    if(cost < min_cost) [[unlikely]]
-                    {
-                        min_cost = cost;
-                        bp_proof = i;
-                        node.bp_proof[a + (other_a.num_sels() * b)] = i;
-                    }
-                }
-
-                new_matrix[a + (other_a.num_sels() * b)] = min_cost;
+                unsigned const ab = a + (other_a.num_sels() * b);
+                node.bp_proof[ab] = min_sum(row.data(), matrix_b + b * n, n, new_matrix[ab]);
             }
-        });
+        }
 
         bp_stack.push_back(&node);
         other_a.dec_degree(edge_a);
         other_b.dec_degree(edge_b);
-        add_edge(other_a, other_b, std::move(new_matrix));
+        add_edge(other_a, other_b, new_matrix);
 
         assert(node.degree == 2);
 
@@ -285,6 +364,7 @@ void pbqp_t::heuristic_reduction(pbqp_node_t& node)
 {
     assert(node.degree > 2);
     dprint(log, "-PBQP RN", &node);
+    ++heuristic_reductions;
 
     pbqp_cost_t min_i_cost = ~0ull;
     unsigned best_i = ~0u;
@@ -12,6 +12,7 @@
 #include <cstdint>
 #include <array>
 #include <algorithm>
+#include <memory>
 #include <vector>
 
 #include <boost/container/deque.hpp>
@@ -81,10 +82,7 @@ struct pbqp_edge_t
         assert(from_sel < nodes[FROM]->num_sels());
         assert(to_sel < nodes[TO]->num_sels());
             
-        unsigned const index = from_sel + (to_sel * nodes[FROM]->num_sels());
-        assert(index < cost_matrix.size());
-
-        return cost_matrix[index];
+        return cost_matrix[from_sel + (to_sel * nodes[FROM]->num_sels())];
     }
 
     bool eq(pbqp_node_t const& from, pbqp_node_t const& to) const
@@ -93,7 +91,7 @@ struct pbqp_edge_t
         { return nodes[FROM] == &to && nodes[TO] == &from; }
 
     std::array<pbqp_node_t*, 2> nodes; // from, to
-    std::vector<pbqp_cost_t> cost_matrix;
+    pbqp_cost_t* cost_matrix; // Allocated by 'pbqp_t::new_matrix'.
 };
 
 class pbqp_t
@@ -101,17 +99,48 @@ class pbqp_t
 public:
     explicit pbqp_t(log_t* log) : log(log) {}
 
-    void add_edge(pbqp_node_t& from, pbqp_node_t& to, std::vector<pbqp_cost_t> cost_matrix);
-    void solve(std::vector<pbqp_node_t*> order);
+    // Returns a zeroed matrix to pass to 'add_edge'.
+    // Matrices live until the solver is destroyed.
+    pbqp_cost_t* new_matrix(std::size_t size);
+
+    void add_edge(pbqp_node_t& from, pbqp_node_t& to, pbqp_cost_t* cost_matrix);
+
+    // When the solution isn't known to be optimal, it's improved by a local search
+    // making up to 'refine_passes' passes over the nodes.
+    void solve(std::vector<pbqp_node_t*> order, unsigned refine_passes = 0);
 
 private:
+    // A copy of a node and its edges, from before any reductions.
+    struct original_node_t
+    {
+        pbqp_node_t* node;
+        std::vector<pbqp_cost_t> cost_vector;
+        std::vector<pbqp_edge_t> edges;
+    };
+
     void reduce(pbqp_node_t& node);
     bool optimal_reduction(pbqp_node_t& node);
     void heuristic_reduction(pbqp_node_t& node);
+    void refine(std::vector<original_node_t> const& original, unsigned passes);
 
     bc::deque<pbqp_edge_t> edge_pool;
     std::vector<pbqp_node_t*> bp_stack; // back propagation stack
     log_t* log;
+
+    // Cost matrices are allocated from these chunks:
+    std::vector<std::unique_ptr<pbqp_cost_t[]>> arena;
+    pbqp_cost_t* arena_next = nullptr;
+    std::size_t arena_left = 0;
+
+    // Scratch space for 'optimal_reduction':
+    std::vector<pbqp_cost_t> scratch_a;
+    std::vector<pbqp_cost_t> scratch_b;
+    std::vector<pbqp_cost_t> row;
+
+    // Once solving, matrices are treated as immutable, so that
+    // the original problem remains intact for 'refine'.
+    bool solving = false;
+    unsigned heuristic_reductions = 0;
 };
 
 #endif
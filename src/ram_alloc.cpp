@@ -1,5 +1,9 @@
 #include "ram_alloc.hpp"
 
+#include <atomic>
+#include <cmath>
+#include <exception>
+
 #ifndef NDEBUG
 #include <iostream>
 #endif
@@ -14,6 +18,7 @@
 #include "ram.hpp"
 #include "rom.hpp"
 #include "debug_print.hpp"
+#include "thread.hpp"
 
 namespace  // anonymous namespace
 {
@@ -54,6 +59,35 @@ sram_request_t sram_request(mods_t const* mods)
     return SRAM_MAYBE;
 }
 
+constexpr float interrupt_weight = loop_weight; // NMI / IRQ handlers run every frame.
+
+// Buckets 'heat' by how many loops deep it is.
+static int heat_class(float heat)
+{
+    int c = 0;
+    for(; heat >= loop_weight; heat /= loop_weight)
+        ++c;
+    return c;
+}
+
+// Handles are assigned in parse order, which depends on thread timing.
+// Orderings break ties by name instead, so that allocation is identical at any -j.
+bool name_less(fn_ht a, fn_ht b) 
+{ 
+    return a->global.name < b->global.name; 
+}
+
+bool name_less(locator_t a, locator_t b)
+{
+    gmember_t const& ga = *a.gmember();
+    gmember_t const& gb = *b.gmember();
+    if(ga.gvar.global.name != gb.gvar.global.name)
+        return ga.gvar.global.name < gb.gvar.global.name;
+    if(ga.member() != gb.member())
+        return ga.member() < gb.member();
+    return a.atom() < b.atom();
+}
+
 // Allocates a span inside 'usable_ram'.
 static span_t alloc_ram(ram_sets_t const& usable_ram, std::size_t size, 
                         zp_request_t zp, sram_request_t sram,
@@ -210,6 +244,15 @@ private:
     template<step_t Step>
     void alloc_locals(romv_t romv, fn_ht h);
 
+    std::vector<std::vector<fn_ht>> split_components(std::vector<fn_ht> const& fn_order) const;
+
+    template<step_t Step>
+    void alloc_components(romv_t romv, std::vector<std::vector<fn_ht>> const& components);
+
+    void estimate_frequencies();
+
+    void alloc_locals_graph(std::array<std::vector<fn_ht>, NUM_ROMV> const& fn_orders);
+
     struct group_vars_d
     {
         // Addresses that can be used to allocate globals.
@@ -231,6 +274,17 @@ private:
         // This is used to order in which fn lvars are allocated.
         unsigned lvar_count = 0;
 
+        // Estimated number of times the fn runs, relative to a mode running once.
+        float freq = -1.0f;
+
+        // Estimated number of times each instruction of the fn's asm_proc_t runs,
+        // relative to the fn running once.
+        std::vector<float> inst_freq;
+
+        // Estimated number of times each lvar is accessed, relative to the fn running once.
+        // This is used to give the hottest lvars ZP.
+        std::vector<float> lvar_heat;
+
         // Addresses that can be used to allocate lvars.
         std::array<ram_sets_t, NUM_ROMV> usable_ram;
 
@@ -255,6 +309,9 @@ private:
     std::vector<group_vars_d> group_vars_data;
     std::vector<fn_d> fn_data;
 
+    // Every fn, sorted using 'name_less'.
+    std::vector<fn_ht> fns_by_name;
+
     // Tracks allocations for an entire mode / nmi / irq.
     // This is used to implement romv.
     std::array<std::vector<ram_sets_t>, NUM_ROMV> romv_allocated;
@@ -290,6 +347,11 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
     group_vars_data.resize(group_vars_ht::pool().size());
     fn_data.resize(fn_ht::pool().size());
 
+    fns_by_name.assign(fn_ht::handles().begin(), fn_ht::handles().end());
+    std::sort(fns_by_name.begin(), fns_by_name.end(), [](fn_ht a, fn_ht b) { return name_less(a, b); });
+
+    estimate_frequencies();
+
     ///////////////////
     // ALLOC GLOBALS //
     ///////////////////
@@ -468,18 +530,45 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
         // Count how often gmembers appears in emitted code.
         // We'll eventually allocate using the use count as a heuristic
 
+        // Likewise, estimate how often gmembers are accessed at runtime.
+        // This is used to give the hottest gmembers ZP.
+
         rh::batman_map<locator_t, unsigned> gmember_count;
+        rh::batman_map<locator_t, float> gmember_heat;
         for(gvar_t const& gvar : gvar_ht::values())
-            gvar.for_each_locator([&](locator_t loc){ gmember_count.insert({ loc.mem_head(), 0 }); });
+        {
+            gvar.for_each_locator([&](locator_t loc)
+            { 
+                gmember_count.insert({ loc.mem_head(), 0 }); 
+                gmember_heat.insert({ loc.mem_head(), 0.0f }); 
+            });
+        }
 
-        for(fn_t const& fn : fn_ht::values())
+        for(fn_ht fn_h : fns_by_name)
         {
+            fn_t const& fn = *fn_h;
             rom_proc_t const* rom_proc = &fn.rom_proc().safe();
+            fn_d const& d = data(fn_h);
+            auto const& code = rom_proc->asm_proc().code;
+            assert(code.size() == d.inst_freq.size());
+
+            for(unsigned i = 0; i < code.size(); ++i)
+            {
+                asm_inst_t const& inst = code[i];
+                float const heat = d.freq * d.inst_freq[i];
 
-            for(asm_inst_t const& inst : rom_proc->asm_proc().code)
                 if(inst.arg.lclass() == LOC_GMEMBER)
+                {
                     if(unsigned* count = gmember_count.mapped(inst.arg.mem_head()))
                         *count += 1;
+                    if(float* h = gmember_heat.mapped(inst.arg.mem_head()))
+                        *h += heat;
+                }
+
+                if(inst.alt.lclass() == LOC_GMEMBER)
+                    if(float* h = gmember_heat.mapped(inst.alt.mem_head()))
+                        *h += heat;
+            }
         }
 
         // Find unused variables and issue a warning
@@ -504,6 +593,7 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
         {
             unsigned score;
             locator_t loc;
+            float heat = 0.0f; // Per byte
         };
 
         std::vector<rank_t> ordered_gmembers_zp;
@@ -532,19 +622,25 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
                 if(pair.second == 0)
                     continue;
 
+                float const heat = gmember_heat[pair.first] / pair.first.mem_size();
+
                 if(pair.first.mem_zp_only())
-                    ordered_gmembers_zp.push_back({ pair.first.mem_size(), pair.first });
+                    ordered_gmembers_zp.push_back({ pair.first.mem_size(), pair.first, heat });
                 else
-                    non_zp_vec.push_back({ (pair.first.mem_size() * size_scale) + pair.second, pair.first });
+                    non_zp_vec.push_back({ (pair.first.mem_size() * size_scale) + pair.second, pair.first, heat });
             }
         }
 
-        std::sort(ordered_gmembers_zp.begin(), ordered_gmembers_zp.end(), 
-                  [](auto const& lhs, auto const& rhs) { return lhs.score > rhs.score; });
-        std::sort(ordered_gmembers.begin(), ordered_gmembers.end(), 
-                  [](auto const& lhs, auto const& rhs) { return lhs.score > rhs.score; });
-        std::sort(ordered_gmembers_aligned.begin(), ordered_gmembers_aligned.end(), 
-                  [](auto const& lhs, auto const& rhs) { return lhs.score > rhs.score; });
+        auto const rank_greater = [](rank_t const& lhs, rank_t const& rhs)
+        { 
+            if(lhs.score != rhs.score)
+                return lhs.score > rhs.score; 
+            return name_less(lhs.loc, rhs.loc);
+        };
+
+        std::sort(ordered_gmembers_zp.begin(), ordered_gmembers_zp.end(), rank_greater);
+        std::sort(ordered_gmembers.begin(), ordered_gmembers.end(), rank_greater);
+        std::sort(ordered_gmembers_aligned.begin(), ordered_gmembers_aligned.end(), rank_greater);
 
         // Estimate which locators will go into ZP.
 
@@ -603,10 +699,15 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
         for(rank_t const& rank : ordered_gmembers_zp)
             estimate_gmember_loc(rank.loc);
 
-        for(rank_t const& rank : ordered_gmembers)
-            estimate_gmember_loc(rank.loc);
+        // The rest are estimated hottest byte first, rather than in allocation order.
+        std::vector<rank_t> ordered_gmembers_heat;
+        ordered_gmembers_heat.reserve(ordered_gmembers.size() + ordered_gmembers_aligned.size());
+        ordered_gmembers_heat.insert(ordered_gmembers_heat.end(), ordered_gmembers.begin(), ordered_gmembers.end());
+        ordered_gmembers_heat.insert(ordered_gmembers_heat.end(), ordered_gmembers_aligned.begin(), ordered_gmembers_aligned.end());
+        std::stable_sort(ordered_gmembers_heat.begin(), ordered_gmembers_heat.end(), 
+                         [](auto const& lhs, auto const& rhs) { return lhs.heat > rhs.heat; });
 
-        for(rank_t const& rank : ordered_gmembers_aligned)
+        for(rank_t const& rank : ordered_gmembers_heat)
             estimate_gmember_loc(rank.loc);
 
         // For global vars that have init expressions,
@@ -644,6 +745,11 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
             }
         };
 
+        auto const sort_inits = [](group_inits_t& inits)
+        {
+            std::sort(inits.init.begin(), inits.init.end(), [](locator_t a, locator_t b) { return name_less(a, b); });
+        };
+
         for(group_t* g : group_vars_ht::values())
         {
             group_inits_t zero_inits  = {};
@@ -652,6 +758,9 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
             for(gvar_ht v : g->vars()->gvars())
                 check_init(v, zero_inits, value_inits);
 
+            sort_inits(zero_inits);
+            sort_inits(value_inits);
+
             if(!zero_inits.init.empty())
                 ordered_inits.push_back(std::move(zero_inits));
             if(!value_inits.init.empty())
@@ -666,14 +775,21 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
             for(gvar_ht v : gvar_t::groupless_gvars())
                 check_init(v, zero_inits, value_inits);
 
+            sort_inits(zero_inits);
+            sort_inits(value_inits);
+
             if(!zero_inits.init.empty())
                 ordered_inits.push_back(std::move(zero_inits));
             if(!value_inits.init.empty())
                 ordered_inits.push_back(std::move(value_inits));
         }
 
-        std::sort(ordered_inits.begin(), ordered_inits.end(), 
-                  [](auto const& lhs, auto const& rhs) { return lhs.score > rhs.score; });
+        std::sort(ordered_inits.begin(), ordered_inits.end(), [](auto const& lhs, auto const& rhs)
+        { 
+            if(lhs.score != rhs.score)
+                return lhs.score > rhs.score; 
+            return name_less(lhs.init.front(), rhs.init.front());
+        });
 
         auto const alloc_gmember_loc = [&](locator_t loc)
         {
@@ -862,10 +978,16 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
         for(unsigned i = 0; i < ranks.size(); ++i)
             build_order(romv_t(i), fn_orders[i], ranks[i]);
 
+        std::vector<fn_set_t const*> fn_sets;
         for(fn_set_t const& set : fn_set_ht::values())
+            fn_sets.push_back(&set);
+        std::sort(fn_sets.begin(), fn_sets.end(), [](fn_set_t const* a, fn_set_t const* b)
+            { return a->global.name < b->global.name; });
+
+        for(fn_set_t const* set : fn_sets)
         {
-            romv_t const set_romv = set.romv();
-            for(fn_ht fn : set)
+            romv_t const set_romv = set->romv();
+            for(fn_ht fn : *set)
                 build_order(set_romv, fn_orders[set_romv], fn);
         }
 
@@ -873,13 +995,20 @@ ram_allocator_t::ram_allocator_t(log_t* log, ram_bitset_t const& initial_usable_
             for(fn_ht fn : fn_orders[i])
                 dprint(log, "-RAM_ALLOC_BUILD_ORDER", i, fn->global.name);
 
-        for(int romv = NUM_ROMV - 1; romv >= 0; --romv)
-            for(fn_ht fn : fn_orders[romv])
-                alloc_locals<ZP_ONLY_ALLOC>(romv_t(romv), fn);
+        if(compiler_options().ram_alloc_graph)
+            alloc_locals_graph(fn_orders);
+        else
+        {
+            std::array<std::vector<std::vector<fn_ht>>, NUM_ROMV> components;
+            for(unsigned i = 0; i < NUM_ROMV; ++i)
+                components[i] = split_components(fn_orders[i]);
+
+            for(int romv = NUM_ROMV - 1; romv >= 0; --romv)
+                alloc_components<ZP_ONLY_ALLOC>(romv_t(romv), components[romv]);
 
-        for(int romv = NUM_ROMV - 1; romv >= 0; --romv)
-            for(fn_ht fn : fn_orders[romv])
-                alloc_locals<FULL_ALLOC>(romv_t(romv), fn);
+            for(int romv = NUM_ROMV - 1; romv >= 0; --romv)
+                alloc_components<FULL_ALLOC>(romv_t(romv), components[romv]);
+        }
     }
 }
 
@@ -887,7 +1016,9 @@ void ram_allocator_t::build_order(romv_t romv, std::vector<fn_ht>& fn_order, std
 {
     std::sort(input_fns.begin(), input_fns.end(), [&](fn_ht a, fn_ht b)
     {
-        return data(a).lvar_count > data(b).lvar_count;
+        if(data(a).lvar_count != data(b).lvar_count)
+            return data(a).lvar_count > data(b).lvar_count;
+        return name_less(a, b);
     });
 
     for(fn_ht input_fn : input_fns)
@@ -917,6 +1048,378 @@ void ram_allocator_t::build_order(romv_t romv, std::vector<fn_ht>& fn_order, fn_
     d.step[romv] = BUILD_ORDER;
 }
 
+void ram_allocator_t::estimate_frequencies()
+{
+    // An instruction's frequency is 'loop_weight' raised to its loop depth.
+    // A fn's frequency is the sum of the frequencies of its call sites,
+    // scaled by the frequency of the calling fn.
+
+    struct call_site_t
+    {
+        fn_ht caller;
+        float freq;
+    };
+
+    std::vector<std::vector<call_site_t>> call_sites(fn_data.size());
+
+    for(fn_ht fn_h : fns_by_name)
+    {
+        fn_t const& fn = *fn_h;
+        fn_d& d = data(fn_h);
+        auto const& code = fn.rom_proc().safe().asm_proc().code;
+        d.inst_freq = fn.rom_proc().safe().asm_proc().inst_freqs();
+
+        for(unsigned i = 0; i < code.size(); ++i)
+        {
+            asm_inst_t const& inst = code[i];
+            if((op_flags(inst.op) & (ASMF_CALL | ASMF_JUMP)) && inst.arg.lclass() == LOC_FN)
+                call_sites[inst.arg.fn().id].push_back({ fn.handle(), d.inst_freq[i] });
+        }
+
+        if(fn.fclass == FN_CT)
+            continue;
+
+        d.lvar_heat.resize(fn.lvars().num_this_lvars());
+        for(unsigned i = 0; i < code.size(); ++i)
+        {
+            for(locator_t loc : { code[i].arg, code[i].alt })
+            {
+                int lvar_i = fn.lvars().index(loc);
+                if(lvar_i < 0 || unsigned(lvar_i) >= fn.lvars().num_this_lvars())
+                    continue;
+
+                // Pointer hi bytes are allocated alongside their lo byte.
+                auto const& info = fn.lvars().this_lvar_info(lvar_i);
+                if(info.ptr_hi)
+                    lvar_i = info.ptr_alt;
+
+                d.lvar_heat[lvar_i] += d.inst_freq[i];
+            }
+        }
+    }
+
+    auto const calc_freq = [&](auto const& self, fn_ht fn) -> float
+    {
+        fn_d& d = data(fn);
+
+        if(d.freq >= 0.0f)
+            return d.freq;
+
+        d.freq = 0.0f; // Breaks cycles created by 'goto mode'.
+
+        float freq = 0.0f;
+        if(fn->fclass == FN_MODE)
+            freq = 1.0f;
+        else if(fn->fclass == FN_NMI || fn->fclass == FN_IRQ)
+            freq = interrupt_weight;
+
+        for(call_site_t const& site : call_sites[fn.id])
+            freq += self(self, site.caller) * site.freq;
+
+        // Fns without known callers (i.e. those called through pointers)
+        // are assumed to run at least once.
+        d.freq = std::max(freq, 1.0f);
+        fn->assign_freq(d.freq);
+        dprint(log, "-RAM_ALLOC_FREQ", fn->global.name, d.freq);
+        return d.freq;
+    };
+
+    for(fn_ht fn : fn_ht::handles())
+        calc_freq(calc_freq, fn);
+}
+
+// An alternative to 'alloc_locals', which builds an interference graph
+// of every lvar in the program and colors it, most constrained lvars first.
+// 
+// Lvars live in the same fn, and the args / returns of called fns,
+// are connected by explicit edges. Interference with the lvars of called fns
+// and with other romvs is tracked using the same bitsets 'alloc_locals' uses,
+// but updated per lvar rather than per fn.
+// As a result, lvars in sibling call subtrees share bytes whenever 
+// their liveness allows it, regardless of the order fns were compiled in.
+void ram_allocator_t::alloc_locals_graph(std::array<std::vector<fn_ht>, NUM_ROMV> const& fn_orders)
+{
+    struct node_t
+    {
+        romv_t romv;
+        fn_ht fn;
+        unsigned lvar_i;
+        unsigned parent; // Union-find, as fn sets share their args and returns.
+    };
+
+    std::vector<node_t> nodes;
+
+    // Maps (romv, fn) to the index of its first node.
+    std::array<std::vector<int>, NUM_ROMV> fn_nodes;
+
+    for(unsigned romv = 0; romv < NUM_ROMV; ++romv)
+    {
+        fn_nodes[romv].resize(fn_data.size(), -1);
+
+        for(fn_ht fn : fn_orders[romv])
+        {
+            fn_nodes[romv][fn.id] = nodes.size();
+            for(unsigned i = 0; i < fn->lvars().num_this_lvars(); ++i)
+                nodes.push_back({ romv_t(romv), fn, i, unsigned(nodes.size()) });
+        }
+    }
+
+    auto const node_index = [&](romv_t romv, fn_ht fn, int lvar_i) -> int
+    {
+        int const first = fn_nodes[romv][fn.id];
+        if(first < 0 || lvar_i < 0 || unsigned(lvar_i) >= fn->lvars().num_this_lvars())
+            return -1;
+        return first + lvar_i;
+    };
+
+    auto const find = [&](unsigned i) -> unsigned
+    {
+        while(nodes[i].parent != i)
+            i = nodes[i].parent = nodes[nodes[i].parent].parent;
+        return i;
+    };
+
+    auto const unite = [&](unsigned a, unsigned b)
+    {
+        a = find(a);
+        b = find(b);
+        if(a != b)
+            nodes[std::max(a, b)].parent = std::min(a, b);
+    };
+
+    // Pointer hi bytes are allocated alongside their lo byte:
+    for(unsigned i = 0; i < nodes.size(); ++i)
+    {
+        auto const& info = nodes[i].fn->lvars().this_lvar_info(nodes[i].lvar_i);
+        if(info.ptr_hi)
+            unite(i, node_index(nodes[i].romv, nodes[i].fn, info.ptr_alt));
+    }
+
+    // Fns in a set share their args and returns:
+    for(fn_set_t const& set : fn_set_ht::values())
+    {
+        romv_t const set_romv = set.romv();
+
+        for(fn_ht fn : set)
+        for(fn_ht co : set)
+        {
+            if(co == fn)
+                continue;
+
+            for(unsigned i = 0; i < fn->lvars().num_this_lvars(); ++i)
+            {
+                locator_t const loc = fn->lvars().locator(i);
+                if(!is_arg_ret(loc.lclass()))
+                    continue;
+
+                locator_t co_loc = loc;
+                co_loc.set_handle(co.id);
+
+                int const a = node_index(set_romv, fn, i);
+                int const b = node_index(set_romv, co, co->lvars().index(co_loc));
+                if(a >= 0 && b >= 0)
+                    unite(a, b);
+            }
+        }
+    }
+
+    // Build the edges, between representative nodes:
+    std::vector<std::vector<unsigned>> edges(nodes.size());
+    std::vector<std::vector<unsigned>> members(nodes.size());
+
+    for(unsigned i = 0; i < nodes.size(); ++i)
+    {
+        node_t const& node = nodes[i];
+        lvars_manager_t const& lvars = node.fn->lvars();
+        unsigned const rep = find(i);
+        members[rep].push_back(i);
+
+        bitset_for_each(lvars.bitset_size(), lvars.lvar_interferences(node.lvar_i), [&](unsigned j)
+        {
+            int other;
+            if(j < lvars.num_this_lvars())
+                other = node_index(node.romv, node.fn, j);
+            else
+            {
+                locator_t const loc = lvars.locator(j);
+                if(!has_fn(loc.lclass()))
+                    return;
+                other = node_index(node.romv, loc.fn(), loc.fn()->lvars().index(loc));
+            }
+
+            if(other < 0)
+                return;
+
+            unsigned const other_rep = find(other);
+            if(other_rep != rep)
+            {
+                edges[rep].push_back(other_rep);
+                edges[other_rep].push_back(rep);
+            }
+        });
+    }
+
+    // Callers of each fn, including indirect ones:
+    std::vector<std::vector<fn_ht>> callers(fn_data.size());
+    for(fn_ht fn : fn_ht::handles())
+        if(fn->fclass != FN_CT)
+            fn->ir_calls().for_each([&](fn_ht call) { callers[call.id].push_back(fn); });
+
+    // Order the nodes:
+    struct rank_t
+    {
+        bool zp_only;
+        int coldness;
+        unsigned degree;
+        unsigned node;
+    };
+
+    std::vector<rank_t> ordered_nodes;
+
+    for(unsigned i = 0; i < nodes.size(); ++i)
+    {
+        if(find(i) != i)
+            continue;
+
+        std::sort(edges[i].begin(), edges[i].end());
+        edges[i].erase(std::unique(edges[i].begin(), edges[i].end()), edges[i].end());
+
+        bool zp_only = false;
+        unsigned size = 1;
+        float heat = 0.0f;
+        for(unsigned m : members[i])
+        {
+            fn_d const& d = data(nodes[m].fn);
+            auto const& info = nodes[m].fn->lvars().this_lvar_info(nodes[m].lvar_i);
+            zp_only |= info.zp_only;
+            size = std::max<unsigned>(size, info.size);
+            heat += d.freq * d.lvar_heat[nodes[m].lvar_i];
+        }
+
+        ordered_nodes.push_back({ zp_only, -heat_class(heat / size), unsigned(edges[i].size()), i });
+    }
+
+    std::sort(ordered_nodes.begin(), ordered_nodes.end(), [](rank_t const& lhs, rank_t const& rhs)
+    {
+        if(lhs.zp_only != rhs.zp_only)
+            return lhs.zp_only;
+        if(lhs.coldness != rhs.coldness)
+            return lhs.coldness < rhs.coldness;
+        if(lhs.degree != rhs.degree)
+            return lhs.degree > rhs.degree;
+        return lhs.node < rhs.node;
+    });
+
+    // Color the graph:
+    std::vector<span_t> spans(nodes.size());
+
+    // RAM used by any lvar so far. Reusing it keeps the allocation dense.
+    std::array<ram_sets_t, NUM_ROMV> used_ram = {};
+
+    for(rank_t const& rank : ordered_nodes)
+    {
+        romv_t const romv = nodes[rank.node].romv;
+
+        ram_sets_t usable = static_usable_ram;
+        unsigned size = 1;
+        bool zp_valid = true;
+        bool zp_only = false;
+
+        for(unsigned m : members[rank.node])
+        {
+            node_t const& node = nodes[m];
+            fn_d const& d = data(node.fn);
+            auto const& info = node.fn->lvars().this_lvar_info(node.lvar_i);
+
+            if(!info.ptr_hi)
+                size = std::max<unsigned>(size, info.size);
+            zp_valid &= info.zp_valid;
+            zp_only |= info.zp_only;
+
+            usable &= d.usable_ram[romv];
+
+            for(fn_ht fn : node.fn->lvars().fn_interferences(node.lvar_i))
+                usable -= data(fn).recursive_lvar_ram[romv];
+
+            for(unsigned i = 0; i < NUM_ROMV; ++i)
+                if(i != romv)
+                    for(unsigned j : d.romv_interferes[i])
+                        usable -= romv_allocated[i][j];
+        }
+
+        for(unsigned edge : edges[rank.node])
+        {
+            if(span_t const span = spans[edge])
+            {
+                if(span.addr < sram_addr)
+                    usable.ram -= ram_bitset_t::filled(span.addr, span.size);
+                else
+                    *usable.sram -= sram_bitset_t::filled(span.addr - sram_addr, span.size);
+            }
+        }
+
+        node_t const& first = nodes[rank.node];
+        dprint(log, "-RAM_ALLOC_GRAPH", first.fn->global.name, first.lvar_i, romv, size, rank.degree);
+
+        zp_request_t const zp = zp_request(zp_valid, zp_only, first.fn->global.pstring());
+
+        span_t span = alloc_ram(usable & used_ram[romv], size, zp, SRAM_MAYBE);
+        if(!span)
+            span = alloc_ram(usable, size, zp, SRAM_MAYBE);
+        if(!span)
+            throw std::runtime_error(fmt("Unable to allocate local variable in fn % (out of RAM).", first.fn->global.name));
+
+        dprint(log, "--RESULT", span);
+        spans[rank.node] = span;
+
+        ram_sets_t filled;
+        filled.clear_all();
+        if(span.addr < sram_addr)
+            filled.ram = ram_bitset_t::filled(span.addr, span.size);
+        else
+        {
+            assert(mapper().sram);
+            *filled.sram = sram_bitset_t::filled(span.addr - sram_addr, span.size);
+        }
+
+        used_ram[romv] |= filled;
+
+        for(unsigned m : members[rank.node])
+        {
+            node_t const& node = nodes[m];
+            fn_d& d = data(node.fn);
+            auto const& info = node.fn->lvars().this_lvar_info(node.lvar_i);
+
+            // Record the allocation.
+            if(info.ptr_hi)
+                node.fn->assign_lvar_span(romv, node.lvar_i, { .addr = span.addr + 1, .size = 1 });
+            else if(info.ptr_alt >= 0)
+                node.fn->assign_lvar_span(romv, node.lvar_i, { .addr = span.addr, .size = 1 });
+            else
+                node.fn->assign_lvar_span(romv, node.lvar_i, span);
+
+            d.lvar_ram[romv] |= filled;
+            d.recursive_lvar_ram[romv] |= filled;
+            for(fn_ht caller : callers[node.fn.id])
+                data(caller).recursive_lvar_ram[romv] |= filled;
+
+            // Fns called while this lvar is live can't use its RAM.
+            for(fn_ht fn : node.fn->lvars().fn_interferences(node.lvar_i))
+            {
+                data(fn).usable_ram[romv] -= filled;
+                fn->ir_calls().for_each([&](fn_ht call) { data(call).usable_ram[romv] -= filled; });
+            }
+
+            for(unsigned i : d.romv_self[romv])
+                romv_allocated[romv][i] |= filled;
+        }
+    }
+
+    for(unsigned romv = 0; romv < NUM_ROMV; ++romv)
+        for(fn_ht fn : fn_orders[romv])
+            data(fn).step[romv] = FULL_ALLOC;
+}
+
 template<ram_allocator_t::step_t Step>
 void ram_allocator_t::alloc_locals(romv_t const romv, fn_ht h)
 {
@@ -1000,6 +1503,7 @@ void ram_allocator_t::alloc_locals(romv_t const romv, fn_ht h)
 
     struct rank_t
     {
+        int coldness; // Hotter lvars are allocated first, so they get ZP.
         float score;
         unsigned lvar_i;
         constexpr auto operator<=>(rank_t const&) const = default;
@@ -1033,8 +1537,9 @@ void ram_allocator_t::alloc_locals(romv_t const romv, fn_ht h)
         int const usable = lvar_usable_ram[i].popcount();
         int const interferences = bitset_popcount(fn.lvars().bitset_size(), fn.lvars().lvar_interferences(i));
         float const score = float(usable - int(info.size)) / interferences;
+        int const coldness = -heat_class(d.lvar_heat[i] / info.size);
 
-        ordered_lvars.push_back({ score, i });
+        ordered_lvars.push_back({ coldness, score, i });
     }
 
     std::sort(ordered_lvars.begin(), ordered_lvars.end());
@@ -1172,14 +1677,109 @@ void ram_allocator_t::alloc_locals(romv_t const romv, fn_ht h)
     // Update bitsets for fns that call this fn.
     d.recursive_lvar_ram[romv] = d.lvar_ram[romv] | freebie_ram;
 
-    // Propagate romv interferences:
-    for(unsigned i : d.romv_self[romv])
+    // (romv interferences are propagated by 'alloc_components'.)
+
+    d.step[romv] = Step;
+}
+
+// Splits 'fn_order' into groups of fns that share no allocator state.
+// 'alloc_locals' only touches the fns a fn calls, and those in its fn set,
+// so fns whose call graphs don't overlap can be allocated independently.
+// Each group keeps the relative order of 'fn_order'.
+std::vector<std::vector<fn_ht>> ram_allocator_t::split_components(std::vector<fn_ht> const& fn_order) const
+{
+    std::vector<unsigned> parent(fn_data.size());
+    for(unsigned i = 0; i < parent.size(); ++i)
+        parent[i] = i;
+
+    auto const find = [&](unsigned i) -> unsigned
+    {
+        while(parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    auto const unite = [&](fn_ht a, fn_ht b)
+    {
+        unsigned const ra = find(a.id);
+        unsigned const rb = find(b.id);
+        if(ra != rb)
+            parent[std::max(ra, rb)] = std::min(ra, rb);
+    };
+
+    for(fn_ht fn : fn_order)
+    {
+        fn->ir_calls().for_each([&](fn_ht call) { unite(fn, call); });
+
+        if(fn_set_t const* set = fn->fn_set())
+        {
+            for(fn_ht co : *set)
+            {
+                unite(fn, co);
+                co->ir_calls().for_each([&](fn_ht call) { unite(co, call); });
+            }
+        }
+    }
+
+    std::vector<std::vector<fn_ht>> components;
+    rh::batman_map<unsigned, unsigned> component_map;
+
+    for(fn_ht fn : fn_order)
     {
-        dprint(log, "-PROPAGATE", fn.global.name, romv, i);
-        romv_allocated[romv][i] |= d.recursive_lvar_ram[romv];
+        auto result = component_map.insert({ find(fn.id), components.size() });
+        if(result.second)
+            components.emplace_back();
+        components[result.first->second].push_back(fn);
     }
 
-    d.step[romv] = Step;
+    return components;
+}
+
+template<ram_allocator_t::step_t Step>
+void ram_allocator_t::alloc_components(romv_t const romv, std::vector<std::vector<fn_ht>> const& components)
+{
+    // Errors are kept per component and rethrown in order, 
+    // so that the reported error doesn't depend on thread timing.
+    std::vector<std::exception_ptr> errors(components.size());
+    std::atomic<unsigned> next_component = 0;
+
+    unsigned const num_threads = std::min<unsigned>(compiler_options().num_threads, components.size());
+
+    parallelize(std::max(num_threads, 1u), [&](std::atomic<bool>&)
+    {
+        for(unsigned i; (i = next_component++) < components.size();)
+        {
+            try
+            {
+                for(fn_ht fn : components[i])
+                    alloc_locals<Step>(romv, fn);
+            }
+            catch(...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+    }, []{});
+
+    for(std::exception_ptr const& error : errors)
+        if(error)
+            std::rethrow_exception(error);
+
+    // Propagate romv interferences.
+    // This step is done after allocating, as it's shared between components.
+    // (Fns never read 'romv_allocated' of their own romv, so this doesn't change the result.)
+    for(auto const& component : components)
+    {
+        for(fn_ht fn : component)
+        {
+            fn_d const& d = data(fn);
+            for(unsigned i : d.romv_self[romv])
+            {
+                dprint(log, "-PROPAGATE", fn->global.name, romv, i);
+                romv_allocated[romv][i] |= d.recursive_lvar_ram[romv];
+            }
+        }
+    }
 }
 
 } // end anonymous namespace
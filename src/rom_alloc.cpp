@@ -1,6 +1,11 @@
 #include "rom_alloc.hpp"
 
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <exception>
+#include <memory>
+#include <random>
 #include <vector>
 #ifndef NDEBUG
 #include <iostream>
@@ -16,6 +21,74 @@
 #include "span_allocator.hpp"
 #include "debug_print.hpp"
 #include "lt.hpp"
+#include "thread.hpp"
+
+// Strategies used to order onces when searching for a ROM packing.
+// Every strategy from 'PACK_RANDOMIZED' onwards is a randomized restart.
+enum pack_strategy_t : unsigned
+{
+    PACK_BY_RANK,
+    PACK_BY_SIZE,
+    PACK_BY_GROUP,
+    PACK_RANDOMIZED,
+};
+
+constexpr unsigned num_pack_strategies = 8;
+
+// How many bytes of free space a duplicated many is worth, beyond its own size.
+constexpr float many_copy_penalty = 16.0f;
+
+// Limits on the local search, to bound compile times on large projects.
+constexpr unsigned max_search_passes = 4;
+constexpr unsigned max_search_moves = 1 << 16;
+
+// How strongly banks are favored when sharing them turns banked calls into plain JSRs,
+// per doubling of the estimated call frequency.
+constexpr float bank_call_weight = 0.25f;
+
+// Calls 'fn(caller, callee, freq)' for every banked call that turns into a plain JSR
+// when the caller and callee share a bank. (See 'asm_proc_t::remove_banked_jsr'.)
+// 'freq' estimates how often the call runs per frame.
+template<typename Fn>
+static void for_each_bank_call(Fn const& fn)
+{
+    for(rom_proc_ht rom_proc_h : rom_proc_ht::handles())
+    {
+        rom_proc_t const& rom_proc = *rom_proc_h;
+
+        if(!rom_proc.emits())
+            continue;
+
+        asm_proc_t const& asm_proc = rom_proc.asm_proc();
+
+        if(asm_proc.fn && asm_proc.fn->iasm)
+            continue;
+
+        float const proc_freq = asm_proc.fn ? asm_proc.fn->freq() : 1.0f;
+        std::vector<float> const inst_freqs = asm_proc.inst_freqs();
+
+        for(unsigned i = 0; i < asm_proc.code.size(); ++i)
+        {
+            asm_inst_t const& inst = asm_proc.code[i];
+
+            if(inst.alt || inst.arg.lclass() != LOC_FN || unbanked_call_op(inst.op) != JSR_ABSOLUTE)
+                continue;
+
+            fn_ht const call = inst.arg.fn();
+            if(!call || !call->rom_proc() || call->bank_switches() || call->returns_in_different_bank())
+                continue;
+
+            for(unsigned romv = 0; romv < NUM_ROMV; ++romv)
+            {
+                rom_alloc_ht const caller = rom_proc.get_alloc(romv_t(romv));
+                rom_alloc_ht const callee = call->rom_proc()->find_alloc(romv_t(romv));
+
+                if(caller && callee)
+                    fn(caller, callee, proc_freq * inst_freqs[i]);
+            }
+        }
+    }
+}
 
 class rom_allocator_t
 {
@@ -31,6 +104,43 @@ private:
         constexpr auto operator<=>(bank_rank_t const& o) const = default;
     };
 
+    struct once_rank_t
+    {
+        float score;
+        rom_once_ht once;
+
+        constexpr auto operator<=>(once_rank_t const&) const = default;
+    };
+
+    // A single assignment of onces and manys to banks.
+    // Spans and banks are tracked here rather than in the 'rom_once_t's and 'rom_many_t's,
+    // so that several packings can be built in parallel.
+    // The best one gets written to the pools by 'commit'.
+    struct packing_t
+    {
+        std::vector<rom_bank_t> banks;
+        std::vector<bank_rank_t> bank_ranks;
+
+        std::vector<span_t> once_spans;
+        std::vector<span_t> once_allocations; // Includes padding.
+        std::vector<unsigned> once_banks;
+
+        std::vector<span_t> many_spans;
+        std::vector<bank_bitset_t> many_in_banks;
+
+        // The once that couldn't be allocated, if packing failed.
+        rom_once_ht failed = {};
+    };
+
+    // A banked call which becomes a plain JSR if the caller is in a single bank, shared by the callee.
+    // Both the caller and callee are either onces or manys.
+    struct bank_call_t
+    {
+        rom_alloc_ht caller;
+        rom_alloc_ht callee;
+        float freq;
+    };
+
     /////////////
     // MEMBERS //
     /////////////
@@ -39,8 +149,11 @@ private:
     std::vector<bitset_uint_t> group_data_once_bitsets;
     std::vector<bitset_uint_t> group_data_many_bitsets;
 
-    std::vector<rom_bank_t> banks;
-    std::vector<bank_rank_t> bank_ranks;
+    std::vector<rom_bank_t> initial_banks;
+
+    std::vector<bank_call_t> bank_calls;
+    std::vector<std::vector<unsigned>> once_bank_calls; // Indexes 'bank_calls', by caller and by callee.
+    std::vector<std::vector<unsigned>> many_bank_calls; // Indexes 'bank_calls', by caller and by callee.
 
     unsigned many_bs_size = 0;
     unsigned once_bs_size = 0;
@@ -58,28 +171,57 @@ private:
     float once_rank(rom_once_t const& once);
 
     // Used to find the best bank to allocate a once in
-    float bank_rank(rom_bank_t const& bank, rom_once_t const& once);
+    float bank_rank(rom_bank_t const& bank, rom_once_ht once_h);
 
     // Builds 'bank_ranks'.
-    void rank_banks_for(rom_once_t const& once);
+    void rank_banks_for(packing_t& p, rom_once_ht once_h);
 
     // Allocates a 'once', while also allocating the 'many's it uses.
-    void alloc(rom_once_ht once_h);
+    bool alloc(packing_t& p, rom_once_ht once_h);
 
     // Reallocates the many to satisfy a new 'in_banks' set.
-    bool realloc_many(rom_many_ht many_h, bank_bitset_t in_banks);
+    bool realloc_many(packing_t& p, rom_many_ht many_h, bank_bitset_t in_banks);
 
     // Removes the 'many' from a bank.
-    void free_many(rom_many_ht many_h, unsigned bank_i);
+    void free_many(packing_t& p, rom_many_ht many_h, unsigned bank_i);
 
     // Tries to allocate an existing many in a new bank.
-    bool try_include_many(rom_many_ht many_h, unsigned bank_i);
+    bool try_include_many(packing_t& p, rom_many_ht many_h, unsigned bank_i);
 
     // Allocate a static span
     span_t alloc_static(unsigned size);
 
     // Allocate a DPCM span
     span_t alloc_dpcm(unsigned size);
+
+    // Packing search:
+
+    // The order onces get allocated in, for each strategy.
+    std::vector<rom_once_ht> pack_order(unsigned strategy);
+
+    // Allocates every once in 'order', returning false if ROM ran out.
+    bool pack(packing_t& p, std::vector<rom_once_ht> const& order);
+
+    // Higher is better.
+    float score(packing_t const& p) const;
+
+    // Estimated bank switches per frame, made by calls whose caller and callee don't share a bank.
+    float bank_switches(packing_t const& p, bank_call_t const& call) const;
+    float bank_switches(packing_t const& p) const;
+
+    // Local search which moves and swaps onces between banks,
+    // to remove copies of manys and banked calls.
+    void improve(packing_t& p);
+
+    // Moves a once out of its bank, along with the manys only it needed there.
+    void unplace(packing_t& p, rom_once_ht once_h);
+
+    // Allocates an unplaced once into 'bank_i', using its manys' existing spans.
+    // On failure, this can leave behind partial allocations, so the bank should be restored.
+    bool place(packing_t& p, rom_once_ht once_h, unsigned bank_i);
+
+    // Writes the packing to the 'rom_once_t's and 'rom_many_t's.
+    void commit(packing_t const& p);
 };
 
 rom_allocator_t::rom_allocator_t(log_t* log, span_allocator_t& allocator)
@@ -478,40 +620,127 @@ rom_allocator_t::rom_allocator_t(log_t* log, span_allocator_t& allocator)
         }
     }
 
+    //////////////////////////
+    // Collect banked calls //
+    //////////////////////////
+
+    // Reads of once arrays need no tracking here,
+    // as their readers are required to share the array's bank.
+
+    once_bank_calls.resize(num_onces);
+    many_bank_calls.resize(num_manys);
+
+    for_each_bank_call([&](rom_alloc_ht caller, rom_alloc_ht callee, float freq)
+    {
+        // Statics are in every bank, so their calls can't be helped.
+        for(rom_alloc_ht alloc : { caller, callee })
+            if(alloc.rclass() != ROMA_ONCE && alloc.rclass() != ROMA_MANY)
+                return;
+
+        if(caller == callee)
+            return;
+
+        unsigned const call_i = bank_calls.size();
+        bank_calls.push_back({ caller, callee, freq });
+
+        for(rom_alloc_ht alloc : { caller, callee })
+        {
+            if(alloc.rclass() == ROMA_ONCE)
+                once_bank_calls[alloc.handle()].push_back(call_i);
+            else
+                many_bank_calls[alloc.handle()].push_back(call_i);
+        }
+    });
+
     ////////////////
     // Init banks //
     ////////////////
 
     // Copy 'allocator' to fill banks.
-    banks.clear();
+    initial_banks.clear();
     for(unsigned i = 0; i < num_switched_banks; ++i)
-        banks.emplace_back(mapper().fixed_16k ? span_allocator_t(switched_span) : allocator, 
-                           many_bs_size, once_bs_size);
+        initial_banks.emplace_back(mapper().fixed_16k ? span_allocator_t(switched_span) : allocator, 
+                                   many_bs_size, once_bs_size);
 
-    bank_ranks.resize(num_switched_banks);
+    //////////////////////////////
+    // Allocate ONCEs and MANYs //
+    //////////////////////////////
 
-    struct once_rank_t
+    // Each strategy packs the banks independently, starting from an empty state.
+    // Strategy 0 is the original greedy allocator.
+    unsigned const num_strategies = compiler_options().rom_alloc_search ? num_pack_strategies : 1;
+
+    std::vector<packing_t> packings(num_strategies);
+    std::vector<std::exception_ptr> errors(num_strategies);
+    std::atomic<unsigned> next_strategy = 0;
+
+    auto const run_strategies = [&](bool search)
     {
-        float score;
-        rom_once_ht once;
+        unsigned const num_threads = std::min<unsigned>(compiler_options().num_threads, packings.size());
 
-        constexpr auto operator<=>(once_rank_t const&) const = default;
+        parallelize(std::max(num_threads, 1u), [&](std::atomic<bool>&)
+        {
+            for(unsigned i; (i = next_strategy++) < packings.size();)
+            {
+                try
+                {
+                    if(pack(packings[i], pack_order(i)) && search)
+                        improve(packings[i]);
+                }
+                catch(...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            }
+        }, []{});
+
+        for(std::exception_ptr const& error : errors)
+            if(error)
+                std::rethrow_exception(error);
     };
 
-    //////////////////////////////
-    // Allocate ONCEs and MANYs //
-    //////////////////////////////
+    run_strategies(num_strategies > 1);
 
-    // Order 'oncesbathing suit'
-    std::vector<once_rank_t> ordered_onces;
-    ordered_onces.reserve(rom_once_ht::pool().size());
-    for(unsigned i = 0; i < rom_once_ht::pool().size(); ++i)
-        ordered_onces.push_back({ once_rank(*rom_once_ht{i}), {i} });
-    std::sort(ordered_onces.begin(), ordered_onces.end(), std::greater<>{});
+    // If the greedy allocator ran out of space, search for a packing that fits.
+    if(num_strategies == 1 && packings[0].failed)
+    {
+        dprint(log, "-ROM_ALLOC_FALLBACK_TO_SEARCH");
+        packings.resize(num_pack_strategies);
+        errors.resize(num_pack_strategies);
+        next_strategy = 1;
+        run_strategies(true);
+    }
 
-    // Allocate onces (this also allocates their required_manys)
-    for(once_rank_t const& rank : ordered_onces)
-        alloc(rank.once);
+    // Pick the best packing, breaking ties by bank switches, then by the lower strategy.
+    packing_t const* best = nullptr;
+    float best_score = 0.0f;
+    float best_switches = 0.0f;
+    for(packing_t const& p : packings)
+    {
+        if(p.failed)
+            continue;
+
+        float const s = score(p);
+        float const switches = bank_switches(p);
+        dprint(log, "-ROM_ALLOC_STRATEGY", &p - packings.data(), s, switches);
+
+        if(!best || s > best_score || (s == best_score && switches < best_switches))
+        {
+            best = &p;
+            best_score = s;
+            best_switches = switches;
+        }
+    }
+
+    if(!best)
+        throw std::runtime_error(fmt("Unable to allocate address of size % (out of ROM space).", packings[0].failed->max_size()));
+
+    commit(*best);
+
+    float total_switches = 0.0f;
+    for(bank_call_t const& call : bank_calls)
+        total_switches += call.freq;
+    dprint(log, "-ROM_ALLOC_BANK_SWITCHES", best_switches, total_switches);
 }
 
 float rom_allocator_t::once_rank(rom_once_t const& once)
@@ -530,8 +759,10 @@ float rom_allocator_t::once_rank(rom_once_t const& once)
     return many_size + once.max_size() * 4 + related * 2;
 }
 
-float rom_allocator_t::bank_rank(rom_bank_t const& bank, rom_once_t const& once)
+float rom_allocator_t::bank_rank(rom_bank_t const& bank, rom_once_ht once_h)
 {
+    rom_once_t const& once = *once_h;
+
     // Count how much we have to allocate for required_manys
     bitset_uint_t* const unallocated_manys = ALLOCA_T(bitset_uint_t, many_bs_size);
     bitset_copy(many_bs_size, unallocated_manys, once.required_manys);
@@ -557,67 +788,73 @@ float rom_allocator_t::bank_rank(rom_bank_t const& bank, rom_once_t const& once)
         unrelated = bitset_popcount(once_bs_size, onces);
     }
 
+    // Sum the frequency of the banked calls that sharing this bank would remove
+    float call_freq = 0.0f;
+    for(unsigned call_i : once_bank_calls[once_h.id])
+    {
+        bank_call_t const& call = bank_calls[call_i];
+        rom_alloc_ht const other = call.caller == rom_alloc_ht(once_h) ? call.callee : call.caller;
+
+        if(other.rclass() == ROMA_ONCE ? bank.allocated_onces.test(other.handle())
+                                       : bank.allocated_manys.test(other.handle()))
+        {
+            call_freq += call.freq;
+        }
+    }
+
     float const m = 4 * (bank.allocator.bytes_free());// - once.max_size());
     float const r = bank.allocator.initial_bytes_free() * std::sqrt((float)bank.allocator.spans_free());
     // Old formula:
     //return -(unallocated_many_size) + related - (unrelated * 0.125f) + (bank.allocator.bytes_free() / r);
-    return -(std::sqrt(unallocated_many_size) * 0.0625f) + (related) - (unrelated * 0.125f) + (m / r);
+    return -(std::sqrt(unallocated_many_size) * 0.0625f) + (related) - (unrelated * 0.125f) + (m / r)
+           + std::log2(1.0f + call_freq) * bank_call_weight;
 }
 
-void rom_allocator_t::rank_banks_for(rom_once_t const& once)
+void rom_allocator_t::rank_banks_for(packing_t& p, rom_once_ht once_h)
 {
-    assert(bank_ranks.size() == banks.size());
+    assert(p.bank_ranks.size() == p.banks.size());
 
-    for(unsigned i = 0; i < banks.size(); ++i)
-        bank_ranks[i] = { bank_rank(banks[i], once), i };
+    for(unsigned i = 0; i < p.banks.size(); ++i)
+        p.bank_ranks[i] = { bank_rank(p.banks[i], once_h), i };
 
-    std::sort(bank_ranks.begin(), bank_ranks.end(), std::greater<>{});
+    std::sort(p.bank_ranks.begin(), p.bank_ranks.end(), std::greater<>{});
 }
 
-void rom_allocator_t::alloc(rom_once_ht once_h)
+bool rom_allocator_t::alloc(packing_t& p, rom_once_ht once_h)
 {
-    rom_once_t& once = *once_h;
+    rom_once_t const& once = *once_h;
     bc::small_vector<rom_many_ht, 32> realloced_manys;
 
-    rank_banks_for(once); // Builds 'bank_ranks'
+    rank_banks_for(p, once_h); // Builds 'bank_ranks'
 
-    for(bank_rank_t const& r : bank_ranks)
+    for(bank_rank_t const& r : p.bank_ranks)
     {
         unsigned const bank_i = r.bank_index;
-        rom_bank_t& bank = banks[bank_i];
+        rom_bank_t& bank = p.banks[bank_i];
 
         // 1. try to allocate manys required by 'once'
         // 2. then try to allocate 'once'
 
         realloced_manys.clear();
 
-        bitset_for_each_test(many_bs_size, once.required_manys, [&](unsigned i)
-        {
-            rom_many_ht many_h = rom_many_ht{ i };
-            rom_many_t& many = *many_h;
-
-            return true;
-        });
-
         // TODO: Sort the manys first, instead of iterating bitset.
         bool const allocated_manys = 
         bitset_for_each_test(many_bs_size, once.required_manys, [&](unsigned i)
         {
             rom_many_ht many_h = rom_many_ht{ i };
-            rom_many_t& many = *many_h;
 
-            if(many.in_banks.test(bank_i))
+            if(p.many_in_banks[i].test(bank_i))
                 return true;
 
-            if(try_include_many(many_h, bank_i))
+            if(try_include_many(p, many_h, bank_i))
             {
                 realloced_manys.push_back(many_h);
                 return true;
             }
 
-            bank_bitset_t in_banks = many.in_banks;
+            bank_bitset_t in_banks = p.many_in_banks[i];
             in_banks.set(bank_i);
-            if(realloc_many(many_h, std::move(in_banks)))
+            if(realloc_many(p, many_h, std::move(in_banks)))
             {
                 realloced_manys.push_back(many_h);
                 return true;
@@ -627,81 +864,85 @@ void rom_allocator_t::alloc(rom_once_ht once_h)
         });
         
         // If we succeeded in allocating manys, try to allocate 'once's span:
-        // (conditional has side effect assignment)
-        if(!allocated_manys || !(once.span = bank.allocator.alloc(once.max_size(), once.desired_alignment).object))
+        span_allocation_t allocation = {};
+        if(allocated_manys)
+            allocation = bank.allocator.alloc(once.max_size(), once.desired_alignment);
+
+        p.once_spans[once_h.id] = allocation.object;
+
+        if(!allocation)
         {
             // If we fail, free allocated 'many' memory.
             for(rom_many_ht many_h : realloced_manys)
-                free_many(many_h, bank_i);
+                free_many(p, many_h, bank_i);
             continue;
         }
 
         // If we succeed, update and we're done
-        once.bank = bank_i;
+        p.once_allocations[once_h.id] = allocation.allocation;
+        p.once_banks[once_h.id] = bank_i;
         bank.allocated_onces.set(once_h.id);
-        passert(once.span.addr % once.desired_alignment == 0, once.span.addr, once.desired_alignment);
+        passert(allocation.object.addr % once.desired_alignment == 0, allocation.object.addr, once.desired_alignment);
 
 #ifndef NDEBUG
         bool const did_manys  = 
         bitset_for_each_test(many_bs_size, once.required_manys, [&](unsigned i)
         {
-            rom_many_ht many_h = rom_many_ht{ i };
-            rom_many_t& many = *many_h;
-            return many.span == span_t{0,1} || many.in_banks.test(bank_i);
+            return p.many_spans[i] == span_t{0,1} || p.many_in_banks[i].test(bank_i);
         });
         assert(did_manys);
 #endif
-        return;
+        return true;
     }
 
-    throw std::runtime_error(fmt("Unable to allocate address of size % (out of ROM space).", once.max_size()));
+    return false;
 }
 
-bool rom_allocator_t::try_include_many(rom_many_ht many_h, unsigned bank_i)
+bool rom_allocator_t::try_include_many(packing_t& p, rom_many_ht many_h, unsigned bank_i)
 {
-    rom_many_t& many = *many_h;
+    span_t const many_span = p.many_spans[many_h.id];
 
-    assert(!many.in_banks.test(bank_i)); // Handle prior.
+    assert(!p.many_in_banks[many_h.id].test(bank_i)); // Handle prior.
 
-    if(many.span == span_t{ .addr = 0, .size = 1 })
+    if(many_span == span_t{ .addr = 0, .size = 1 })
         return true;
 
-    if(!many.span)
+    if(!many_span)
         return false;
 
-    span_allocation_t const allocated_spans = banks[bank_i].allocator.alloc_at(many.span);
+    span_allocation_t const allocated_spans = p.banks[bank_i].allocator.alloc_at(many_span);
     if(!allocated_spans)
         return false;
 
-    auto result = banks[bank_i].many_spans.insert({ many_h, allocated_spans.allocation });
+    auto result = p.banks[bank_i].many_spans.insert({ many_h, allocated_spans.allocation });
     assert(result.second);
 
-    many.in_banks.set(bank_i);
-    banks[bank_i].allocated_manys.set(many_h.id);
+    p.many_in_banks[many_h.id].set(bank_i);
+    p.banks[bank_i].allocated_manys.set(many_h.id);
 
     return true;
 }
 
-void rom_allocator_t::free_many(rom_many_ht many_h, unsigned bank_i)
+void rom_allocator_t::free_many(packing_t& p, rom_many_ht many_h, unsigned bank_i)
 {
-    rom_many_t& many = *many_h;
-    rom_bank_t& bank = banks[bank_i];
+    rom_many_t const& many = *many_h;
+    rom_bank_t& bank = p.banks[bank_i];
 
     if(many.max_size() == 0)
     {
-        many.in_banks.clear(bank_i);
+        p.many_in_banks[many_h.id].clear(bank_i);
         return;
     }
 
-    assert(many.in_banks.test(bank_i));
+    assert(p.many_in_banks[many_h.id].test(bank_i));
 
     // We have to free the span returned by the allocator,
     // NOT the span we stored in many, which is smaller.
     span_t const* allocated_span = bank.many_spans.mapped(many_h);
 
-    passert(allocated_span, many.span, bank_i);
+    passert(allocated_span, p.many_spans[many_h.id], bank_i);
     assert(*allocated_span);
-    assert(allocated_span->contains(many.span));
+    assert(allocated_span->contains(p.many_spans[many_h.id]));
 
     bank.allocator.free(*allocated_span);
     bank.allocated_manys.clear(many_h.id);
@@ -709,25 +950,27 @@ void rom_allocator_t::free_many(rom_many_ht many_h, unsigned bank_i)
 
     assert(!bank.many_spans.mapped(many_h));
 
-    many.in_banks.clear(bank_i);
+    p.many_in_banks[many_h.id].clear(bank_i);
 }
 
-bool rom_allocator_t::realloc_many(rom_many_ht many_h, bank_bitset_t in_banks)
+bool rom_allocator_t::realloc_many(packing_t& p, rom_many_ht many_h, bank_bitset_t in_banks)
 {
-    rom_many_t& many = *many_h;
+    rom_many_t const& many = *many_h;
+    span_t& many_span = p.many_spans[many_h.id];
+    bank_bitset_t& many_in_banks = p.many_in_banks[many_h.id];
 
-    assert((many.in_banks & in_banks) == many.in_banks);
+    assert((many_in_banks & in_banks) == many_in_banks);
 
     if(many.max_size() == 0)
     {
-        many.span = { .addr = 0, .size = 1 };
-        many.in_banks = std::move(in_banks);
+        many_span = { .addr = 0, .size = 1 };
+        many_in_banks = std::move(in_banks);
         return true;
     }
 
     // Build bitset 'free', which tracks which spans are free in every banks required.
     span_allocator_t::bitset_t free = {};
-    in_banks.for_each([&](unsigned bank_i){ free |= banks[bank_i].allocator.allocated_bitset(); });
+    in_banks.for_each([&](unsigned bank_i){ free |= p.banks[bank_i].allocator.allocated_bitset(); });
     bitset_flip_all(free.size(), free.data());
     unsigned const bpb = span_allocator_t::bytes_per_bit(switched_span);
     bitset_mark_consecutive(free.size(), free.data(), (many.max_size() + bpb - 1) / bpb);
@@ -745,7 +988,7 @@ bool rom_allocator_t::realloc_many(rom_many_ht many_h, bank_bitset_t in_banks)
 
     in_banks.for_each([&](unsigned bank_i)
     {
-        span_t const span = banks[bank_i].allocator.unallocated_span_at(free_addr);
+        span_t const span = p.banks[bank_i].allocator.unallocated_span_at(free_addr);
         assert(span);
         assert(span.size >= many.max_size());
         max_start = std::max<unsigned>(max_start, span.addr);
@@ -760,35 +1003,451 @@ bool rom_allocator_t::realloc_many(rom_many_ht many_h, bank_bitset_t in_banks)
     if(!(alloc_at = aligned(range, many.max_size(), many.desired_alignment)))
         return false;
 
-    if(many.span)
+    if(many_span)
     {
         // If we're already allocated, free our memory first.
         // NOTE: Ideally, we would do this much earlier.
-        assert(!many.in_banks.all_clear());
-        many.in_banks.for_each([&](unsigned bank_i){ free_many(many_h, bank_i); });
+        // ('many_in_banks' can be empty here, if allocating a once failed after including this many.)
+        bank_bitset_t const old_banks = many_in_banks;
+        old_banks.for_each([&](unsigned bank_i){ free_many(p, many_h, bank_i); });
     }
 
     // Now allocate in each bank:
     in_banks.for_each([&](unsigned bank_i)
     {
-        span_allocation_t const allocated_spans = banks[bank_i].allocator.alloc_at(alloc_at);
+        span_allocation_t const allocated_spans = p.banks[bank_i].allocator.alloc_at(alloc_at);
 
         passert(allocated_spans, alloc_at);
         assert(allocated_spans.allocation.contains(alloc_at));
 
-        auto result = banks[bank_i].many_spans.insert({ many_h, allocated_spans.allocation });
-        banks[bank_i].allocated_manys.set(many_h.id);
+        auto result = p.banks[bank_i].many_spans.insert({ many_h, allocated_spans.allocation });
+        p.banks[bank_i].allocated_manys.set(many_h.id);
         assert(result.second);
     });
 
     // And store it in the many:
     assert(!in_banks.all_clear());
-    many.span = alloc_at;
-    assert(many.span.addr % many.desired_alignment == 0);
-    many.in_banks = std::move(in_banks);
+    many_span = alloc_at;
+    assert(many_span.addr % many.desired_alignment == 0);
+    many_in_banks = std::move(in_banks);
 
     return true;
 }
+
+////////////////////
+// Packing search //
+////////////////////
+
+std::vector<rom_once_ht> rom_allocator_t::pack_order(unsigned strategy)
+{
+    unsigned const num_onces = rom_once_ht::pool().size();
+
+    std::vector<once_rank_t> ordered_onces;
+    ordered_onces.reserve(num_onces);
+
+    if(strategy == PACK_BY_SIZE)
+    {
+        // Largest first, counting the manys that have to come along.
+        for(unsigned i = 0; i < num_onces; ++i)
+        {
+            rom_once_t const& once = *rom_once_ht{i};
+            int size = once.max_size();
+            bitset_for_each(many_bs_size, once.required_manys, [&](unsigned m)
+            {
+                size += rom_many_ht{m}->max_size();
+            });
+            ordered_onces.push_back({ float(size), {i} });
+        }
+    }
+    else
+    {
+        for(unsigned i = 0; i < num_onces; ++i)
+            ordered_onces.push_back({ once_rank(*rom_once_ht{i}), {i} });
+
+        if(strategy >= PACK_RANDOMIZED)
+        {
+            // Randomized restarts perturb the default ranking.
+            // The seed is fixed, so the output is reproducible.
+            std::mt19937 rng(strategy);
+            for(once_rank_t& rank : ordered_onces)
+                rank.score *= 0.75f + 0.5f * (float(rng() - rng.min()) / float(rng.max() - rng.min()));
+        }
+    }
+
+    std::sort(ordered_onces.begin(), ordered_onces.end(), std::greater<>{});
+
+    if(strategy == PACK_BY_GROUP)
+    {
+        // Keep related onces adjacent, so each group gets packed together.
+        // Groups are ordered by their best ranked once, which comes first after sorting.
+        rh::robin_map<bitset_uint_t const*, float> group_ranks;
+        for(once_rank_t const& rank : ordered_onces)
+            if(bitset_uint_t const* group = rank.once->related_onces)
+                group_ranks.insert({ group, rank.score });
+
+        auto const group_key = [&](once_rank_t const& rank)
+        {
+            bitset_uint_t const* group = rank.once->related_onces;
+            if(group)
+                return std::make_pair(*group_ranks.mapped(group), std::size_t(group - group_data_once_bitsets.data()));
+            return std::make_pair(rank.score, group_data_once_bitsets.size() + rank.once.id);
+        };
+
+        std::stable_sort(ordered_onces.begin(), ordered_onces.end(), [&](once_rank_t const& a, once_rank_t const& b)
+        {
+            auto const ka = group_key(a);
+            auto const kb = group_key(b);
+            if(ka.first != kb.first)
+                return ka.first > kb.first;
+            return ka.second < kb.second;
+        });
+    }
+
+    std::vector<rom_once_ht> order;
+    order.reserve(ordered_onces.size());
+    for(once_rank_t const& rank : ordered_onces)
+        order.push_back(rank.once);
+    return order;
+}
+
+bool rom_allocator_t::pack(packing_t& p, std::vector<rom_once_ht> const& order)
+{
+    p.banks = std::vector<rom_bank_t>(initial_banks);
+    p.bank_ranks.resize(p.banks.size());
+
+    unsigned const num_onces = rom_once_ht::pool().size();
+    p.once_spans.assign(num_onces, span_t{});
+    p.once_allocations.assign(num_onces, span_t{});
+    p.once_banks.assign(num_onces, ~0u);
+
+    unsigned const num_manys = rom_many_ht::pool().size();
+    p.many_spans.assign(num_manys, span_t{});
+    p.many_in_banks.assign(num_manys, bank_bitset_t{});
+
+    p.failed = {};
+
+    // Allocate onces (this also allocates their required_manys)
+    for(rom_once_ht once : order)
+    {
+        if(!alloc(p, once))
+        {
+            p.failed = once;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+float rom_allocator_t::score(packing_t const& p) const
+{
+    // Every copy of a many already costs its size in 'bytes_free'.
+    // Copies are penalized beyond that, as each pins down the same address in another bank.
+    int bytes_free = 0;
+    for(rom_bank_t const& bank : p.banks)
+        bytes_free += bank.allocator.bytes_free();
+
+    int copies = 0;
+    for(unsigned i = 0; i < p.many_in_banks.size(); ++i)
+        if(rom_many_ht{i}->max_size() > 0)
+            copies += std::max<int>(p.many_in_banks[i].popcount() - 1, 0);
+
+    return float(bytes_free) - float(copies) * many_copy_penalty;
+}
+
+float rom_allocator_t::bank_switches(packing_t const& p, bank_call_t const& call) const
+{
+    unsigned bank_i = ~0u;
+    if(call.caller.rclass() == ROMA_ONCE)
+        bank_i = p.once_banks[call.caller.handle()];
+    else if(p.many_in_banks[call.caller.handle()].popcount() == 1)
+        bank_i = p.many_in_banks[call.caller.handle()].lowest_bit_set();
+
+    if(bank_i != ~0u)
+    {
+        if(call.callee.rclass() == ROMA_ONCE)
+        {
+            if(p.once_banks[call.callee.handle()] == bank_i)
+                return 0.0f;
+        }
+        else if(p.many_in_banks[call.callee.handle()].test(bank_i))
+            return 0.0f;
+    }
+
+    return call.freq;
+}
+
+float rom_allocator_t::bank_switches(packing_t const& p) const
+{
+    float switches = 0.0f;
+    for(bank_call_t const& call : bank_calls)
+        switches += bank_switches(p, call);
+    return switches;
+}
+
+void rom_allocator_t::unplace(packing_t& p, rom_once_ht once_h)
+{
+    unsigned const bank_i = p.once_banks[once_h.id];
+    rom_bank_t& bank = p.banks[bank_i];
+
+    bank.allocator.free(p.once_allocations[once_h.id]);
+    bank.allocated_onces.clear(once_h.id);
+    p.once_banks[once_h.id] = ~0u;
+
+    // Find the manys still needed by the other onces of this bank.
+    bitset_uint_t* const needed = ALLOCA_T(bitset_uint_t, many_bs_size);
+    bitset_clear_all(many_bs_size, needed);
+    bank.allocated_onces.for_each([&](unsigned once_i)
+    {
+        bitset_or(many_bs_size, needed, rom_once_ht{once_i}->required_manys);
+    });
+
+    // Free the rest, as long as a copy remains in another bank.
+    bitset_for_each(many_bs_size, once_h->required_manys, [&](unsigned i)
+    {
+        rom_many_ht const many_h = { i };
+        if(!bitset_test(needed, i) && p.many_in_banks[i].test(bank_i) 
+           && many_h->max_size() > 0 && p.many_in_banks[i].popcount() > 1)
+        {
+            free_many(p, many_h, bank_i);
+        }
+    });
+}
+
+bool rom_allocator_t::place(packing_t& p, rom_once_ht once_h, unsigned bank_i)
+{
+    rom_once_t const& once = *once_h;
+    rom_bank_t& bank = p.banks[bank_i];
+
+    assert(p.once_banks[once_h.id] == ~0u);
+
+    bool const allocated_manys = 
+    bitset_for_each_test(many_bs_size, once.required_manys, [&](unsigned i)
+    {
+        return p.many_in_banks[i].test(bank_i) || try_include_many(p, rom_many_ht{ i }, bank_i);
+    });
+
+    if(!allocated_manys)
+        return false;
+
+    span_allocation_t const allocation = bank.allocator.alloc(once.max_size(), once.desired_alignment);
+    if(!allocation)
+        return false;
+
+    p.once_spans[once_h.id] = allocation.object;
+    p.once_allocations[once_h.id] = allocation.allocation;
+    p.once_banks[once_h.id] = bank_i;
+    bank.allocated_onces.set(once_h.id);
+    return true;
+}
+
+void rom_allocator_t::improve(packing_t& p)
+{
+    unsigned const num_onces = rom_once_ht::pool().size();
+    unsigned budget = max_search_moves;
+
+    // Moves only affect two banks and the manys of the onces moved,
+    // so it's enough to score those.
+    auto const bytes_free = [&](unsigned bank_a, unsigned bank_b) -> float
+    {
+        return p.banks[bank_a].allocator.bytes_free() + p.banks[bank_b].allocator.bytes_free();
+    };
+
+    auto const copies = [&](rom_once_ht once_h) -> float
+    {
+        int copies = 0;
+        bitset_for_each(many_bs_size, once_h->required_manys, [&](unsigned i)
+        {
+            if(rom_many_ht{i}->max_size() > 0)
+                copies += p.many_in_banks[i].popcount();
+        });
+        return copies * many_copy_penalty;
+    };
+
+    // Likewise, only the banked calls of the onces moved and the manys they require can change.
+    bc::small_vector<unsigned, 64> touched_calls;
+    auto const switches = [&](std::initializer_list<rom_once_ht> onces) -> float
+    {
+        if(bank_calls.empty())
+            return 0.0f;
+
+        touched_calls.clear();
+        for(rom_once_ht once_h : onces)
+        {
+            touched_calls.insert(touched_calls.end(), once_bank_calls[once_h.id].begin(), once_bank_calls[once_h.id].end());
+            bitset_for_each(many_bs_size, once_h->required_manys, [&](unsigned i)
+            {
+                touched_calls.insert(touched_calls.end(), many_bank_calls[i].begin(), many_bank_calls[i].end());
+            });
+        }
+
+        std::sort(touched_calls.begin(), touched_calls.end());
+        touched_calls.erase(std::unique(touched_calls.begin(), touched_calls.end()), touched_calls.end());
+
+        float switches = 0.0f;
+        for(unsigned call_i : touched_calls)
+            switches += bank_switches(p, bank_calls[call_i]);
+        return switches;
+    };
+
+    // Moves are kept when they improve the score or the bank switches, without worsening the other.
+    auto const keep = [](float old_score, float new_score, float old_switches, float new_switches) -> bool
+    {
+        return (new_score > old_score && new_switches <= old_switches)
+            || (new_score >= old_score && new_switches < old_switches);
+    };
+
+    // Rejected moves are undone by restoring the two banks wholesale,
+    // as freeing and reallocating spans doesn't always give back the same padding.
+    // (The restored allocators don't keep their 'initial_bytes_free', but that's only used while packing.)
+    struct saved_once_t
+    {
+        rom_once_ht once;
+        span_t span;
+        span_t allocation;
+        unsigned bank;
+    };
+
+    std::vector<rom_bank_t> saved_banks;
+    std::array<unsigned, 2> saved_bank_indexes;
+    bc::small_vector<saved_once_t, 2> saved_onces;
+    bc::small_vector<std::pair<unsigned, bank_bitset_t>, 32> saved_in_banks;
+
+    auto const save = [&](unsigned bank_a, unsigned bank_b, std::initializer_list<rom_once_ht> onces)
+    {
+        saved_banks.clear();
+        saved_banks.emplace_back(p.banks[bank_a]);
+        saved_banks.emplace_back(p.banks[bank_b]);
+        saved_bank_indexes = { bank_a, bank_b };
+
+        saved_onces.clear();
+        saved_in_banks.clear();
+        for(rom_once_ht once_h : onces)
+        {
+            saved_onces.push_back({ once_h, p.once_spans[once_h.id], p.once_allocations[once_h.id], p.once_banks[once_h.id] });
+            bitset_for_each(many_bs_size, once_h->required_manys, [&](unsigned i)
+            {
+                saved_in_banks.push_back({ i, p.many_in_banks[i] });
+            });
+        }
+    };
+
+    auto const restore = [&]()
+    {
+        for(unsigned i = 0; i < 2; ++i)
+        {
+            rom_bank_t& bank = p.banks[saved_bank_indexes[i]];
+            std::destroy_at(&bank);
+            std::construct_at(&bank, saved_banks[i]);
+        }
+
+        for(saved_once_t const& saved : saved_onces)
+        {
+            p.once_spans[saved.once.id] = saved.span;
+            p.once_allocations[saved.once.id] = saved.allocation;
+            p.once_banks[saved.once.id] = saved.bank;
+        }
+
+        for(auto const& pair : saved_in_banks)
+            p.many_in_banks[pair.first] = pair.second;
+    };
+
+    bc::small_vector<rom_once_ht, 32> candidates;
+
+    for(unsigned pass = 0; pass < max_search_passes; ++pass)
+    {
+        bool improved = false;
+
+        for(unsigned once_i = 0; once_i < num_onces; ++once_i)
+        {
+            rom_once_ht const once_a = { once_i };
+
+            for(unsigned bank_b = 0; bank_b < p.banks.size(); ++bank_b)
+            {
+                unsigned const bank_a = p.once_banks[once_i];
+                if(bank_a == bank_b)
+                    continue;
+
+                if(budget == 0)
+                    return;
+                --budget;
+
+                // First try moving 'once_a' into 'bank_b':
+
+                float const old_score = bytes_free(bank_a, bank_b) - copies(once_a);
+                float const old_switches = switches({ once_a });
+
+                save(bank_a, bank_b, { once_a });
+                unplace(p, once_a);
+                bool const fits = place(p, once_a, bank_b);
+
+                if(fits && keep(old_score, bytes_free(bank_a, bank_b) - copies(once_a),
+                                old_switches, switches({ once_a })))
+                {
+                    improved = true;
+                    continue;
+                }
+
+                restore();
+
+                if(fits)
+                    continue;
+
+                // If that didn't fit, try swapping with a once in 'bank_b':
+
+                candidates.clear();
+                p.banks[bank_b].allocated_onces.for_each([&](unsigned once_j)
+                {
+                    candidates.push_back({ once_j });
+                });
+
+                for(rom_once_ht once_b : candidates)
+                {
+                    if(budget == 0)
+                        return;
+                    --budget;
+
+                    float const old_swap_score = old_score - copies(once_b);
+                    float const old_swap_switches = switches({ once_a, once_b });
+
+                    save(bank_a, bank_b, { once_a, once_b });
+                    unplace(p, once_a);
+                    unplace(p, once_b);
+
+                    if(place(p, once_a, bank_b) && place(p, once_b, bank_a)
+                       && keep(old_swap_score, bytes_free(bank_a, bank_b) - copies(once_a) - copies(once_b),
+                               old_swap_switches, switches({ once_a, once_b })))
+                    {
+                        improved = true;
+                        break;
+                    }
+
+                    restore();
+                }
+            }
+        }
+
+        if(!improved)
+            break;
+    }
+}
+
+void rom_allocator_t::commit(packing_t const& p)
+{
+    for(unsigned i = 0; i < p.once_spans.size(); ++i)
+    {
+        rom_once_t& once = *rom_once_ht{i};
+        once.span = p.once_spans[i];
+        once.bank = p.once_banks[i];
+    }
+
+    for(unsigned i = 0; i < p.many_spans.size(); ++i)
+    {
+        rom_many_t& many = *rom_many_ht{i};
+        many.span = p.many_spans[i];
+        many.in_banks = p.many_in_banks[i];
+    }
+}
     
 void alloc_rom(log_t* log, span_allocator_t allocator)
 {
@@ -801,6 +1460,21 @@ void print_rom(std::ostream& o)
 
     o << "ROM:\n\n";
 
+    // Estimate how often banked calls run, and how many of those became plain JSRs by sharing a bank.
+    float eliminated_switches = 0.0f;
+    float remaining_switches = 0.0f;
+    for_each_bank_call([&](rom_alloc_ht caller, rom_alloc_ht callee, float freq)
+    {
+        int const bank = caller.only_bank();
+        bool same_bank = false;
+        if(bank >= 0)
+            callee.for_each_bank([&](unsigned other_bank){ same_bank |= unsigned(bank) == other_bank; });
+        (same_bank ? eliminated_switches : remaining_switches) += freq;
+    });
+
+    o << "BANK SWITCHES PER FRAME (estimated): "
+      << eliminated_switches << " eliminated, " << remaining_switches << " remaining\n\n";
+
     for(auto const& st : rom_static_ht::values())
     {
         o << "STATIC " << st.span << '\n';
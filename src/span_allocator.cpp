@@ -111,16 +111,23 @@ void span_allocator_t::free(span_t span)
 
     // Update the bitset
 
-    unsigned const start = ((span.addr - m_initial.addr) * bitset_t::num_bits) / m_bs_span;
-    unsigned const end = ((span.end() - m_initial.addr) * bitset_t::num_bits + m_bs_span - 1) / m_bs_span;
-    unsigned const size = end - start;
-    passert(size > 0, span, m_initial);
+    // Only clear bits that are entirely free.
+    // Bits on the edges can still be partially allocated by neighboring spans.
+    // ('span' has been combined with its free neighbors, so this is exact.)
+    unsigned const start = ((span.addr - m_initial.addr) * bitset_t::num_bits + m_bs_span - 1) / m_bs_span;
+    unsigned end = ((span.end() - m_initial.addr) * bitset_t::num_bits) / m_bs_span;
+    if(span.end() == m_initial.end()) // The padding past the end is never allocated.
+        end = ((span.end() - m_initial.addr) * bitset_t::num_bits + m_bs_span - 1) / m_bs_span;
 #ifndef NDEBUG
-    span_t c = { start * m_bs_span / bitset_t::num_bits + m_initial.addr, 
-                 size * m_bs_span / bitset_t::num_bits };
-    passert(c.contains(span), span, c);
+    if(end > start)
+    {
+        std::uint64_t const c_addr = start * m_bs_span / bitset_t::num_bits + m_initial.addr;
+        std::uint64_t const c_end = std::min<std::uint64_t>(end * m_bs_span / bitset_t::num_bits + m_initial.addr, m_initial.end());
+        passert(c_addr >= span.addr && c_end <= span.end(), span, c_addr, c_end);
+    }
 #endif
-    m_allocated_bs -= bitset_t::filled(start, size);
+    if(end > start)
+        m_allocated_bs -= bitset_t::filled(start, end - start);
 
     assert_valid();
 }
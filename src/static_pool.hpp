@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -14,7 +15,7 @@
 #include "intrusive_pool.hpp"
 #include "thread.hpp"
 
-template<typename T, typename Tag = T>
+template<typename T, typename Tag = T, typename Cold = void>
 class static_intrusive_pool_t;
 
 // This pool can hold any type, but only 1 type at a time (you must call
@@ -131,7 +132,9 @@ public:
     };
 };
 
-template<typename T, typename Tag>
+// 'Cold' is an optional type stored in parallel to 'T', indexed by handle.
+// It's meant for rarely accessed data that would otherwise bloat 'T'.
+template<typename T, typename Tag, typename Cold>
 class static_intrusive_pool_t
 {
 public:
@@ -176,9 +179,29 @@ private:
     static auto& pool() { return _pool; }
     static auto& pool_ptr() { return _pool_ptr; }
 #endif
+
+    // Unlike 'pool', this never relocates its elements as it grows,
+    // so pointers into it remain valid.
+    static auto& cold_storage()
+    {
+        static TLS std::deque<Cold> _cold;
+        return _cold;
+    }
 public:
     static void init() { pool_ptr() = &pool(); (void)pool().data(); }
-    static handle_t alloc() { return { pool().alloc().id }; }
+
+    static handle_t alloc() 
+    { 
+        handle_t const h = { pool().alloc().id };
+        if constexpr(!std::is_void_v<Cold>)
+            if(h.id >= cold_storage().size())
+                cold_storage().resize(h.id + 1);
+        return h;
+    }
+
+    template<typename C = Cold>
+    static C& cold(handle_t h) { assert(h.id < cold_storage().size()); return cold_storage()[h.id]; }
+
     static void free(handle_t h) { pool().free({ h.id }); }
     static void clear() { pool().clear(); }
 
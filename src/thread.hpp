@@ -5,11 +5,16 @@
 #define NO_THREAD
 #endif
 
+#include <algorithm>
+#include <cassert>
 #include <exception>
+#include <functional>
 #include <vector>
 #include <atomic>
 #ifndef NO_THREAD
   #include <thread>
+  #include <mutex>
+  #include <condition_variable>
 #endif
 
 // MinGW has a buggy thread_local implementation.
@@ -19,7 +24,130 @@
 #define TLS thread_local
 #endif
 
-// Launches a bunch of threads and waits until they finish.
+// A fixed set of long-lived worker threads, reused by every parallel phase.
+// Keeping the threads alive keeps their 'TLS' state (pools, isel state, etc) warm.
+// The thread that calls 'run' participates as worker 0,
+// so a pool of size N only spawns N-1 threads.
+class thread_pool_t
+{
+public:
+    explicit thread_pool_t(unsigned num_threads)
+    : m_size(std::max(num_threads, 1u))
+    {
+#ifndef NO_THREAD
+        m_threads.reserve(m_size - 1);
+        for(unsigned i = 1; i < m_size; ++i)
+            m_threads.emplace_back([this, i]{ worker_loop(i); });
+#endif
+        if(!active)
+            active = this;
+    }
+
+    thread_pool_t(thread_pool_t const&) = delete;
+    thread_pool_t& operator=(thread_pool_t const&) = delete;
+
+    ~thread_pool_t()
+    {
+#ifndef NO_THREAD
+        {
+            std::lock_guard lock(m_mutex);
+            m_shutdown = true;
+        }
+        m_start_cv.notify_all();
+
+        for(std::thread& thread : m_threads)
+            thread.join();
+#endif
+        if(active == this)
+            active = nullptr;
+    }
+
+    unsigned size() const { return m_size; }
+
+    // Runs 'fn(worker_i)' on the first 'num_threads' workers, then waits for them all.
+    // 'fn' must not throw.
+    void run(unsigned num_threads, std::function<void(unsigned)> const& fn)
+    {
+        num_threads = std::min(std::max(num_threads, 1u), m_size);
+
+#ifndef NO_THREAD
+        if(num_threads > 1)
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                assert(!m_job);
+                m_job = &fn;
+                m_job_threads = num_threads;
+                m_pending = num_threads - 1;
+                ++m_generation;
+            }
+            m_start_cv.notify_all();
+
+            fn(0);
+
+            std::unique_lock lock(m_mutex);
+            m_done_cv.wait(lock, [this]{ return m_pending == 0; });
+            m_job = nullptr;
+            return;
+        }
+#endif
+        fn(0);
+    }
+
+    // The pool used by 'parallelize', if one exists.
+    inline static thread_pool_t* active = nullptr;
+
+private:
+#ifndef NO_THREAD
+    void worker_loop(unsigned worker_i)
+    {
+        unsigned long long seen_generation = 0;
+
+        while(true)
+        {
+            std::function<void(unsigned)> const* job;
+            {
+                std::unique_lock lock(m_mutex);
+                m_start_cv.wait(lock, [&]{ return m_shutdown || m_generation != seen_generation; });
+
+                if(m_shutdown)
+                    return;
+
+                seen_generation = m_generation;
+
+                if(worker_i >= m_job_threads)
+                    continue;
+
+                job = m_job;
+            }
+
+            (*job)(worker_i);
+
+            bool last;
+            {
+                std::lock_guard lock(m_mutex);
+                last = --m_pending == 0;
+            }
+            if(last)
+                m_done_cv.notify_one();
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start_cv;
+    std::condition_variable m_done_cv;
+    std::function<void(unsigned)> const* m_job = nullptr;
+    unsigned m_job_threads = 0;
+    unsigned m_pending = 0;
+    unsigned long long m_generation = 0;
+    bool m_shutdown = false;
+#endif
+    unsigned m_size;
+};
+
+// Runs 'fn' on 'num_threads' threads and waits until they finish.
+// Uses the active 'thread_pool_t' when there is one.
 template<typename Fn, typename OnError>
 void parallelize(unsigned const num_threads, Fn const& fn, OnError const& on_error)
 {
@@ -35,34 +163,30 @@ void parallelize(unsigned const num_threads, Fn const& fn, OnError const& on_err
         return;
     }
 
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-
     std::vector<std::exception_ptr> exception_ptrs;
     exception_ptrs.resize(num_threads, nullptr);
 
-    for(unsigned i = 0; i < num_threads; ++i)
+    auto const task = [&fn, &exception_thrown, &on_error, &exception_ptrs](unsigned worker_i)
     {
-        threads.emplace_back(
-        [&fn, &exception_thrown, &on_error](std::exception_ptr& exception_ptr)
+        try
         {
-            try
-            {
-                fn(exception_thrown);
-            }
-            catch(...)
-            {
-                exception_ptr = std::current_exception();
-                exception_thrown = true;
-                on_error();
-            }
-        }, std::ref(exception_ptrs[i]));
-    }
-
-    for(unsigned i = 0; i < threads.size(); ++i)
-        threads[i].join();
+            fn(exception_thrown);
+        }
+        catch(...)
+        {
+            exception_ptrs[worker_i] = std::current_exception();
+            exception_thrown = true;
+            on_error();
+        }
+    };
 
-    threads.clear();
+    if(thread_pool_t::active && thread_pool_t::active->size() >= num_threads)
+        thread_pool_t::active->run(num_threads, task);
+    else
+    {
+        thread_pool_t temp_pool(num_threads);
+        temp_pool.run(num_threads, task);
+    }
 
     for(unsigned i = 0; i < num_threads; ++i)
         if(exception_ptrs[i])
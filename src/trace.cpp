@@ -0,0 +1,115 @@
+#include "trace.hpp"
+
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <mutex>
+#include <vector>
+
+#include "json.hpp"
+#include "format.hpp"
+#include "thread.hpp"
+
+using json = nlohmann::json;
+
+namespace
+{
+    struct trace_event_t
+    {
+        char const* name;
+        char const* cat;
+        std::string detail;
+        trace_clock_t::time_point start;
+        trace_clock_t::time_point end;
+    };
+
+    // Each thread records into its own buffer, avoiding contention.
+    struct trace_thread_t
+    {
+        unsigned tid;
+        std::vector<trace_event_t> events;
+    };
+
+    std::ofstream trace_out;
+    trace_clock_t::time_point trace_start;
+
+    std::mutex threads_mutex;
+    std::deque<trace_thread_t> threads; // Deque, so that pointers stay valid.
+
+    TLS trace_thread_t* this_thread = nullptr;
+
+    trace_thread_t& get_this_thread()
+    {
+        if(!this_thread)
+        {
+            std::lock_guard lock(threads_mutex);
+            this_thread = &threads.emplace_back();
+            this_thread->tid = threads.size() - 1;
+        }
+        return *this_thread;
+    }
+
+    long long to_us(trace_clock_t::duration d)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    }
+}
+
+void trace_init(std::string const& path)
+{
+    trace_out.open(path);
+    if(!trace_out)
+        throw std::runtime_error(fmt("Unable to write trace file %", path));
+
+    trace_start = trace_clock_t::now();
+    _trace_enabled = true;
+    get_this_thread(); // The main thread gets tid 0.
+}
+
+void trace_record(char const* name, char const* cat, trace_clock_t::time_point start, std::string detail)
+{
+    get_this_thread().events.push_back({ name, cat, std::move(detail), start, trace_clock_t::now() });
+}
+
+void trace_write()
+{
+    if(!trace_enabled())
+        return;
+
+    json events = json::array();
+
+    std::lock_guard lock(threads_mutex);
+    for(trace_thread_t const& thread : threads)
+    {
+        events.push_back({
+            { "name", "thread_name" },
+            { "ph", "M" },
+            { "pid", 0 },
+            { "tid", thread.tid },
+            { "args", {{ "name", thread.tid ? fmt("worker %", thread.tid) : std::string("main") }} },
+        });
+
+        for(trace_event_t const& event : thread.events)
+        {
+            // Spans with a detail are labeled by it, as it's more specific:
+            json e = {
+                { "name", event.detail.empty() ? event.name : event.detail },
+                { "cat", event.cat },
+                { "ph", "X" },
+                { "pid", 0 },
+                { "tid", thread.tid },
+                { "ts", to_us(event.start - trace_start) },
+                { "dur", to_us(event.end - event.start) },
+            };
+
+            if(!event.detail.empty())
+                e["args"] = {{ "what", event.name }};
+
+            events.push_back(std::move(e));
+        }
+    }
+
+    trace_out << json{{ "traceEvents", std::move(events) }, { "displayTimeUnit", "ms" }}.dump();
+    trace_out.flush();
+}
@@ -0,0 +1,64 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+// Records timed spans of compiler work, to be written as a
+// Chrome trace-event JSON file when using '--trace'.
+// Open the file with 'chrome://tracing' or 'https://ui.perfetto.dev'.
+
+#include <chrono>
+#include <string>
+
+using trace_clock_t = std::chrono::steady_clock;
+
+// Set once at startup, before any threads are running.
+inline bool _trace_enabled = false;
+inline bool trace_enabled() { return _trace_enabled; }
+
+// Opens 'path' for writing and starts recording. Throws on failure.
+void trace_init(std::string const& path);
+
+// Records a span from 'start' until now, on the calling thread.
+// 'name' and 'cat' must be string literals. Thread-safe.
+// When non-empty, 'detail' (such as a global's name) labels the span instead of 'name'.
+void trace_record(char const* name, char const* cat, trace_clock_t::time_point start, std::string detail = {});
+
+// Writes every recorded span to the file opened by 'trace_init'.
+// Call this while no other threads are recording.
+void trace_write();
+
+// Records a span covering the lifetime of this object.
+class trace_span_t
+{
+public:
+    explicit trace_span_t(char const* name, char const* cat = "")
+    : m_name(name)
+    , m_cat(cat)
+    {
+        if(trace_enabled())
+            m_start = trace_clock_t::now();
+    }
+
+    trace_span_t(char const* name, char const* cat, std::string const& detail)
+    : trace_span_t(name, cat)
+    {
+        if(trace_enabled())
+            m_detail = detail;
+    }
+
+    trace_span_t(trace_span_t const&) = delete;
+    trace_span_t& operator=(trace_span_t const&) = delete;
+
+    ~trace_span_t()
+    {
+        if(trace_enabled())
+            trace_record(m_name, m_cat, m_start, std::move(m_detail));
+    }
+
+private:
+    char const* m_name;
+    char const* m_cat;
+    std::string m_detail;
+    trace_clock_t::time_point m_start;
+};
+
+#endif